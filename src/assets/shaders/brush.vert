@@ -2,13 +2,15 @@
 
 uniform mat4 projection;
 uniform vec2 pan;
-uniform vec2 translation;
-uniform vec2 scale;
-uniform float rotation;
 
 layout (location = 0) in vec2 position;
 layout (location = 1) in vec2 texCoord;
 
+// Per-stamp instance attributes
+layout (location = 2) in vec2 translation;
+layout (location = 3) in float rotation;
+layout (location = 4) in float scale;
+
 out vec2 f_texCoord;
 
 mat2 rotate2d(float _angle){
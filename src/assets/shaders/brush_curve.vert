@@ -0,0 +1,91 @@
+#version 330
+
+uniform mat4 projection;
+uniform vec2 pan;
+
+// Segment records of every stroke at the slots of their first vertex, 3 texels each:
+// (a, h1), (h2, b), (first stamp, equidistant steps, unused, unused)
+uniform samplerBuffer segments;
+// Accumulated arc length tables, LENGTHS_SIZE entries per slot packed four to a texel
+uniform samplerBuffer lengths;
+uniform samplerBuffer randomSamples;
+
+uniform int segmentsFirst; // the stroke's slots
+uniform int segmentsLen;
+uniform int stampsFirst;
+uniform int stampsLen;
+uniform bool reverse;
+uniform float strokeScale;
+uniform float jitter;
+
+const int LENGTHS_SIZE = 256; // CURVE_LENGTHS_SIZE
+const int RANDOM_SIZE = 1024; // RANDOM_SAMPLE_SIZE
+
+layout (location = 0) in vec2 position;
+layout (location = 1) in vec2 texCoord;
+
+out vec2 f_texCoord;
+
+mat2 rotate2d(float _angle){
+    return mat2(cos(_angle),-sin(_angle),
+                sin(_angle),cos(_angle));
+}
+
+vec2 bezierCubic(vec2 a, vec2 h1, vec2 h2, vec2 b, float t) {
+	float mt = 1-t;
+	return a*mt*mt*mt + 3*h1*mt*mt*t + 3*h2*mt*t*t + b*t*t*t;
+}
+
+float tableLength(int i) {
+	return texelFetch(lengths, i / 4)[i % 4];
+}
+
+// Same lookup as bezier_distance_closest_t, against the segment's table
+float closestT(int base, float distT) {
+	if(distT <= 0.0 || distT >= 1.0) return distT;
+	
+	float distLength = tableLength(base + LENGTHS_SIZE-1) * distT;
+	int lo = 0;
+	int hi = LENGTHS_SIZE-1;
+	while(lo < hi) {
+		int mid = (lo + hi) / 2;
+		if(tableLength(base + mid) < distLength) lo = mid + 1;
+		else hi = mid;
+	}
+	
+	float prevLength = lo > 0 ? tableLength(base + lo-1) : 0.0;
+	float span = tableLength(base + lo) - prevLength;
+	float t1 = float(lo) / float(LENGTHS_SIZE);
+	if(span <= 0.0) return t1;
+	return t1 + ((distLength - prevLength) / span) / float(LENGTHS_SIZE);
+}
+
+void main() {
+	int stamp = reverse ? stampsFirst + stampsLen-1 - gl_InstanceID : stampsFirst + gl_InstanceID;
+	
+	// Last segment starting at or before the stamp
+	int lo = 0;
+	int hi = segmentsLen-1;
+	while(lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if(int(texelFetch(segments, (segmentsFirst + mid)*3 + 2).x) <= stamp) lo = mid;
+		else hi = mid - 1;
+	}
+	
+	int segment = segmentsFirst + lo;
+	vec4 points0 = texelFetch(segments, segment*3);
+	vec4 points1 = texelFetch(segments, segment*3 + 1);
+	vec4 info = texelFetch(segments, segment*3 + 2);
+	
+	int p = stamp - int(info.x);
+	float t = closestT(segment * LENGTHS_SIZE, float(p) / info.y);
+	vec2 translation = bezierCubic(points0.xy, points0.zw, points1.xy, points1.zw, t);
+	
+	float scale = strokeScale;
+	if(jitter > 0) {
+		scale += scale * mix(-jitter, jitter, texelFetch(randomSamples, p % RANDOM_SIZE).r);
+	}
+	
+	f_texCoord = texCoord;
+	gl_Position = projection * vec4(((position*scale*rotate2d(float(p))) + translation).xy + pan, 0, 1);
+}
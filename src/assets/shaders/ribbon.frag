@@ -0,0 +1,23 @@
+#version 330
+
+uniform sampler2D brushTex;
+uniform sampler2D maskTex;
+uniform float brushAlpha = 1.0;
+uniform vec4 brushColor = vec4( 0.0, 0.0, 0.0, 1.0 );
+
+// x runs along the stroke in brush widths, y across it
+in vec2 f_texCoord;
+
+out vec4 displayColor;
+
+void main() {
+	// the brush clamps to a black border, so keep the tiled lookup off the edge texels' outer halves
+	float halfTexel = 0.5 / textureSize(brushTex, 0).x;
+	float u = clamp(fract(f_texCoord.x), halfTexel, 1 - halfTexel);
+	float intensity = 1 - texture(brushTex, vec2(u, f_texCoord.y)).r;
+	vec4 brush = brushColor * intensity;
+	displayColor = vec4(
+		brush.rgb,
+		min(texture(maskTex, vec2(0.5, f_texCoord.y)).r, intensity) - (1 - brushAlpha)
+	);
+}
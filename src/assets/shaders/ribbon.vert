@@ -0,0 +1,14 @@
+#version 330
+
+uniform mat4 projection;
+uniform vec2 pan;
+
+layout (location = 0) in vec2 position;
+layout (location = 1) in vec2 texCoord;
+
+out vec2 f_texCoord;
+
+void main() {
+	f_texCoord = texCoord;
+	gl_Position = projection * vec4(position.xy + pan, 0, 1);
+}
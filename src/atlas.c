@@ -0,0 +1,93 @@
+#include "atlas.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <math.h>
+
+struct atlas_rect atlas_trim_bounds(const uint8_t* pixels, uint32_t width, uint32_t height) {
+	uint32_t left = width, right = 0, top = height, bottom = 0;
+	for(uint32_t row = 0; row < height; row++) {
+		const uint8_t* p = pixels + (size_t)width * 4 * row;
+		uint32_t first = 0;
+		while(first < width && !p[first * 4 + 3]) first++;
+		if(first == width) continue;
+		uint32_t last = width;
+		while(!p[(last-1) * 4 + 3]) last--;
+		
+		uint32_t y = height - 1 - row; // rows are bottom-up
+		if(y < top) top = y;
+		if(y + 1 > bottom) bottom = y + 1;
+		if(first < left) left = first;
+		if(last > right) right = last;
+	}
+	if(!bottom) return (struct atlas_rect){0};
+	return (struct atlas_rect){left, top, right - left, bottom - top};
+}
+
+void atlas_pack_grid(struct atlas_rect* rects, uint32_t count, uint32_t cell_width, uint32_t cell_height, uint32_t* sheet_width, uint32_t* sheet_height) {
+	uint32_t columns = (uint32_t)ceil(sqrt((double)count * cell_height / cell_width));
+	if(columns < 1) columns = 1;
+	if(columns > count) columns = count ? count : 1;
+	uint32_t rows = (count + columns - 1) / columns;
+	
+	for(uint32_t i = 0; i < count; i++) {
+		rects[i] = (struct atlas_rect){(i % columns) * cell_width, (i / columns) * cell_height, cell_width, cell_height};
+	}
+	*sheet_width = columns * cell_width;
+	*sheet_height = (rows ? rows : 1) * cell_height;
+}
+
+// Next-fit shelves, returning the height the rects take at `width`
+static uint32_t place_shelves(struct atlas_rect* rects, uint32_t count, uint32_t width, bool place) {
+	uint32_t x = 0, y = 0, shelf_height = 0;
+	for(uint32_t i = 0; i < count; i++) {
+		if(!rects[i].width || !rects[i].height) {
+			if(place) rects[i].x = rects[i].y = 0;
+			continue;
+		}
+		if(x && x + rects[i].width > width) {
+			y += shelf_height + ATLAS_PADDING;
+			x = 0;
+			shelf_height = 0;
+		}
+		if(place) {
+			rects[i].x = x;
+			rects[i].y = y;
+		}
+		x += rects[i].width + ATLAS_PADDING;
+		if(rects[i].height > shelf_height) shelf_height = rects[i].height;
+	}
+	return y + shelf_height;
+}
+
+void atlas_pack_shelves(struct atlas_rect* rects, uint32_t count, uint32_t* sheet_width, uint32_t* sheet_height) {
+	uint64_t area = 0;
+	uint32_t widest = 1;
+	for(uint32_t i = 0; i < count; i++) {
+		if(!rects[i].width || !rects[i].height) continue;
+		area += (uint64_t)(rects[i].width + ATLAS_PADDING) * (rects[i].height + ATLAS_PADDING);
+		if(rects[i].width > widest) widest = rects[i].width;
+	}
+	
+	// Shelves leave gaps, so a few widths from the square root of the area up are tried
+	uint32_t best_width = widest, best_height = place_shelves(rects, count, widest, false);
+	uint32_t root = (uint32_t)ceil(sqrt((double)area));
+	for(uint32_t step = 0; step <= 16; step++) {
+		uint32_t width = root + root * step / 16;
+		if(width < widest) continue;
+		uint32_t height = place_shelves(rects, count, width, false);
+		uint32_t side = width > height ? width : height, best_side = best_width > best_height ? best_width : best_height;
+		if(side < best_side || (side == best_side && (uint64_t)width * height < (uint64_t)best_width * best_height)) {
+			best_width = width;
+			best_height = height;
+		}
+	}
+	
+	place_shelves(rects, count, best_width, true);
+	uint32_t used = 1;
+	for(uint32_t i = 0; i < count; i++) {
+		if(rects[i].width && rects[i].x + rects[i].width > used) used = rects[i].x + rects[i].width;
+	}
+	*sheet_width = used;
+	*sheet_height = best_height ? best_height : 1;
+}
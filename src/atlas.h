@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+#define ATLAS_PADDING 1 // transparent pixels between packed frames, so filtering never samples a neighbour
+
+struct atlas_rect {
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+};
+
+// Bounds of the pixels with any alpha in a bottom-up RGBA8 frame, measured top-down. Empty when it is all transparent.
+struct atlas_rect atlas_trim_bounds(const uint8_t* pixels, uint32_t width, uint32_t height);
+
+// Full frames of one size in a grid about as wide as it is tall, in order along each row.
+// Fills in each rect's position and size and the sheet's size.
+void atlas_pack_grid(struct atlas_rect* rects, uint32_t count, uint32_t cell_width, uint32_t cell_height, uint32_t* sheet_width, uint32_t* sheet_height);
+
+// Places rects of the given sizes left to right on shelves, in order, picking the sheet width that keeps it closest to square.
+// Empty rects take no space. Fills in each rect's position and the sheet's size.
+void atlas_pack_shelves(struct atlas_rect* rects, uint32_t count, uint32_t* sheet_width, uint32_t* sheet_height);
@@ -333,4 +333,6 @@ EasingFunction EasingFuncs[] = {
 	BounceEaseIn,
 	BounceEaseOut,
 	BounceEaseInOut,
-};
\ No newline at end of file
+};
+
+const unsigned int EasingFuncsCount = sizeof(EasingFuncs) / sizeof(EasingFuncs[0]);
@@ -2,6 +2,7 @@
 
 typedef float (*EasingFunction)(float);
 extern EasingFunction EasingFuncs[];
+extern const unsigned int EasingFuncsCount;
 
 enum EasingMethod {
 	EASE_LINEAR = 0,
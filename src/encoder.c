@@ -0,0 +1,357 @@
+#include "encoder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
+
+#include "util.h"
+
+bool png_write_file(const char* path, const uint8_t* pixels, uint32_t width, uint32_t height, enum png_compression compression, uint32_t threads, struct encode_times* times) {
+	FILE* file = fopen(path, "wb");
+	if(!file) {
+		fprintf(stderr, "Could not open output file %s\nError: %s\n", path, strerror(errno));
+		return false;
+	}
+	
+	double begin = monotonic_seconds();
+	struct png_buffer png = {0};
+	const size_t row_bytes = (size_t)width * 4;
+	png_encode(&png, pixels + row_bytes * (height - 1), width, height, -(ptrdiff_t)row_bytes, compression, threads);
+	double encoded = monotonic_seconds();
+	
+	bool written = fwrite(png.data, 1, png.len, file) == png.len;
+	bool closed = fclose(file) == 0;
+	png_buffer_destroy(&png);
+	
+	if(times) {
+		times->encode_seconds += encoded - begin;
+		times->write_seconds += monotonic_seconds() - encoded;
+	}
+	if(!written || !closed) {
+		fprintf(stderr, "Could not write output file %s\n", path);
+		return false;
+	}
+	return true;
+}
+
+bool frame_write_file(const char* outdir, uint32_t index, const uint8_t* pixels, uint32_t width, uint32_t height, enum png_compression compression, struct encode_times* times) {
+	char path[4096];
+	snprintf(path, 4096, "%s/line_%04d.png", outdir, index);
+	return png_write_file(path, pixels, width, height, compression, 1, times); // frames are already encoded in parallel
+}
+
+// Copies a frame's file to the `count` frames after it, reusing its encoded bytes
+bool frame_repeat_file(const char* outdir, uint32_t index, uint32_t count, struct encode_times* times) {
+	double begin = monotonic_seconds();
+	char path[4096];
+	snprintf(path, 4096, "%s/line_%04d.png", outdir, index);
+	FILE* file = fopen(path, "rb");
+	if(!file) {
+		fprintf(stderr, "Could not open output file %s\nError: %s\n", path, strerror(errno));
+		return false;
+	}
+	
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	rewind(file);
+	uint8_t* png = size > 0 ? malloc(size) : NULL;
+	bool success = png && fread(png, 1, size, file) == (size_t)size;
+	fclose(file);
+	if(!success) fprintf(stderr, "Could not read output file %s\n", path);
+	
+	for(uint32_t i = index + 1; i <= index + count && success; i++) {
+		snprintf(path, 4096, "%s/line_%04d.png", outdir, i);
+		file = fopen(path, "wb");
+		success = file && fwrite(png, 1, size, file) == (size_t)size;
+		if(file && fclose(file) != 0) success = false;
+		if(!success) fprintf(stderr, "Could not write output file %s\n", path);
+	}
+	
+	free(png);
+	if(times) times->write_seconds += monotonic_seconds() - begin;
+	return success;
+}
+
+// Writes out whatever the PNG stream has encoded so far
+static void drain_png_file_stream(struct png_file_stream* s) {
+	if(!s->buffer.len) return;
+	double begin = monotonic_seconds();
+	if(!s->failed && fwrite(s->buffer.data, 1, s->buffer.len, s->file) != s->buffer.len) {
+		fprintf(stderr, "Could not write output file %s\nError: %s\n", s->path, strerror(errno));
+		s->failed = true;
+	}
+	s->buffer.len = 0;
+	s->times.write_seconds += monotonic_seconds() - begin;
+}
+
+bool png_file_stream_begin(struct png_file_stream* s, const char* path, uint32_t width, uint32_t height, enum png_compression compression, uint32_t threads) {
+	*s = (struct png_file_stream){.path = path};
+	s->file = fopen(path, "wb");
+	if(!s->file) {
+		fprintf(stderr, "Could not open output file %s\nError: %s\n", path, strerror(errno));
+		return false;
+	}
+	s->png = png_stream_begin(&s->buffer, width, height, compression, threads);
+	return true;
+}
+
+void png_file_stream_rows(struct png_file_stream* s, const uint8_t* rows, uint32_t count, ptrdiff_t stride) {
+	double begin = monotonic_seconds();
+	png_stream_rows(s->png, rows, count, stride);
+	s->times.encode_seconds += monotonic_seconds() - begin;
+	drain_png_file_stream(s);
+}
+
+bool png_file_stream_end(struct png_file_stream* s) {
+	if(!png_stream_end(s->png)) s->failed = true;
+	drain_png_file_stream(s);
+	if(fclose(s->file) != 0 && !s->failed) {
+		fprintf(stderr, "Could not write output file %s\n", s->path);
+		s->failed = true;
+	}
+	png_buffer_destroy(&s->buffer);
+	return !s->failed;
+}
+
+#define FRAME_STREAM_IOV_MAX 1024 // the IOV_MAX of Linux and macOS, rows past it go in the next call
+
+// Writes every byte of `iov`, waiting on the reader when the descriptor is full, non-blocking or not
+static bool write_frame_stream(struct frame_stream* s, struct iovec* iov, int iov_len) {
+	while(iov_len > 0) {
+		ssize_t written = writev(s->fd, iov, iov_len > FRAME_STREAM_IOV_MAX ? FRAME_STREAM_IOV_MAX : iov_len);
+		if(written < 0) {
+			if(errno == EINTR) continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK) {
+				struct pollfd wait = {.fd = s->fd, .events = POLLOUT};
+				poll(&wait, 1, -1);
+				continue;
+			}
+			fprintf(stderr, "Could not write output stream %s\nError: %s\n", s->path, strerror(errno));
+			return false;
+		}
+		
+		for(; iov_len > 0 && (size_t)written >= iov->iov_len; iov++, iov_len--) written -= iov->iov_len;
+		if(iov_len > 0) {
+			iov->iov_base = (uint8_t*)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return true;
+}
+
+bool frame_stream_begin(struct frame_stream* s, const char* path, uint32_t width, uint32_t height, float fps, enum frame_stream_format format) {
+	*s = (struct frame_stream){.path = path, .format = format, .width = width, .height = height};
+	if(strcmp(path, "-") == 0) {
+		s->fd = STDOUT_FILENO;
+	} else {
+		s->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644); // blocks until a named pipe has a reader
+		if(s->fd < 0) {
+			fprintf(stderr, "Could not open output stream %s\nError: %s\n", path, strerror(errno));
+			return false;
+		}
+		s->close_fd = true;
+	}
+	
+	if(format == FRAME_STREAM_Y4M) {
+		s->planes = malloc((size_t)width * height * 4);
+		assert(s->planes);
+		
+		// The frame rate as a fraction in thousandths, so 29.97 survives
+		uint32_t num = (uint32_t)lroundf(fps * 1000), den = 1000;
+		uint32_t a = num, b = den;
+		while(b) {
+			uint32_t t = a % b;
+			a = b;
+			b = t;
+		}
+		num /= a;
+		den /= a;
+		char header[128];
+		int len = snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%u:%u Ip A1:1 C444alpha\n", width, height, num, den);
+		struct iovec iov = {header, len};
+		if(!write_frame_stream(s, &iov, 1)) {
+			s->failed = true;
+			frame_stream_end(s);
+			return false;
+		}
+	}
+	return true;
+}
+
+// RGBA to full resolution Y, Cb, Cr and alpha planes
+static void convert_y4m_planes(struct frame_stream* s, const uint8_t* pixels) {
+	const size_t plane = (size_t)s->width * s->height;
+	uint8_t* y = s->planes;
+	uint8_t* u = y + plane;
+	uint8_t* v = u + plane;
+	uint8_t* a = v + plane;
+	for(uint32_t row = 0; row < s->height; row++) {
+		const uint8_t* p = pixels + (size_t)s->width * 4 * (s->height - 1 - row); // bottom-up
+		for(uint32_t x = 0; x < s->width; x++, p += 4) {
+			int32_t r = p[0], g = p[1], b = p[2];
+			*y++ = ((66*r + 129*g + 25*b + 128) >> 8) + 16;
+			*u++ = ((-38*r - 74*g + 112*b + 128) >> 8) + 128;
+			*v++ = ((112*r - 94*g - 18*b + 128) >> 8) + 128;
+			*a++ = p[3];
+		}
+	}
+}
+
+bool frame_stream_write(struct frame_stream* s, const uint8_t* pixels, uint32_t count) {
+	if(s->failed) return false;
+	const size_t row_bytes = (size_t)s->width * 4;
+	
+	double begin = monotonic_seconds();
+	if(s->format == FRAME_STREAM_Y4M) convert_y4m_planes(s, pixels);
+	s->times.encode_seconds += monotonic_seconds() - begin;
+	
+	// Raw rows are gathered straight from the frame, flipping it without a copy
+	struct iovec* iov = malloc(sizeof(struct iovec) * (s->height + 1));
+	assert(iov);
+	for(; count && !s->failed; count--) {
+		int iov_len = 0;
+		if(s->format == FRAME_STREAM_Y4M) {
+			iov[iov_len++] = (struct iovec){"FRAME\n", 6};
+			iov[iov_len++] = (struct iovec){s->planes, row_bytes * s->height};
+		} else {
+			for(uint32_t row = 0; row < s->height; row++) {
+				iov[iov_len++] = (struct iovec){(uint8_t*)pixels + row_bytes * (s->height - 1 - row), row_bytes};
+			}
+		}
+		
+		begin = monotonic_seconds();
+		if(!write_frame_stream(s, iov, iov_len)) s->failed = true;
+		s->times.write_seconds += monotonic_seconds() - begin;
+	}
+	free(iov);
+	return !s->failed;
+}
+
+bool frame_stream_end(struct frame_stream* s) {
+	if(s->close_fd && close(s->fd) != 0 && !s->failed) {
+		fprintf(stderr, "Could not write output stream %s\nError: %s\n", s->path, strerror(errno));
+		s->failed = true;
+	}
+	free(s->planes);
+	return !s->failed;
+}
+
+static void* encoder_thread(void* arg) {
+	struct frame_encoder* e = arg;
+	struct encode_times times = {0};
+	
+	pthread_mutex_lock(&e->lock);
+	for(;;) {
+		while(!e->queue_len && !e->closing) pthread_cond_wait(&e->frame_queued, &e->lock);
+		if(!e->queue_len) break;
+		
+		struct frame_encoder_item item = e->queue[e->queue_first];
+		e->queue_first = (e->queue_first + 1) % e->stats.depth;
+		e->queue_len--;
+		bool skip = e->failed;
+		pthread_mutex_unlock(&e->lock);
+		
+		bool written = skip || frame_write_file(e->outdir, item.index, item.pixels, e->width, e->height, e->compression, &times);
+		
+		pthread_mutex_lock(&e->lock);
+		if(!written) e->failed = true;
+		e->free_buffers[e->free_len++] = item.pixels;
+		pthread_cond_signal(&e->buffer_freed);
+	}
+	e->stats.times.encode_seconds += times.encode_seconds;
+	e->stats.times.write_seconds += times.write_seconds;
+	pthread_mutex_unlock(&e->lock);
+	return NULL;
+}
+
+// 0 threads uses every core, a depth of 0 keeps two frames per thread
+struct frame_encoder* frame_encoder_init(const char* outdir, uint32_t width, uint32_t height, enum png_compression compression, uint32_t threads, uint32_t depth) {
+	if(!threads) {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cores > 0 ? (uint32_t)cores : 1;
+	}
+	if(!depth) depth = threads * 2;
+	
+	struct frame_encoder* e = calloc(1, sizeof(struct frame_encoder));
+	assert(e);
+	e->outdir = outdir;
+	e->width = width;
+	e->height = height;
+	e->compression = compression;
+	e->stats.depth = depth;
+	
+	const size_t frame_bytes = (size_t)width * height * 4;
+	e->storage = malloc(frame_bytes * depth);
+	e->free_buffers = malloc(sizeof(uint8_t*) * depth);
+	e->queue = malloc(sizeof(struct frame_encoder_item) * depth);
+	e->threads = malloc(sizeof(pthread_t) * threads);
+	assert(e->storage && e->free_buffers && e->queue && e->threads);
+	for(uint32_t b = 0; b < depth; b++) e->free_buffers[e->free_len++] = e->storage + frame_bytes * b;
+	
+	pthread_mutex_init(&e->lock, NULL);
+	pthread_cond_init(&e->frame_queued, NULL);
+	pthread_cond_init(&e->buffer_freed, NULL);
+	
+	for(; e->stats.threads < threads; e->stats.threads++) {
+		if(pthread_create(&e->threads[e->stats.threads], NULL, encoder_thread, e) != 0) break;
+	}
+	assert(e->stats.threads > 0);
+	return e;
+}
+
+// A free buffer for the next frame, blocking while every buffer is queued or being encoded.
+// NULL once a frame has failed to write.
+uint8_t* frame_encoder_acquire(struct frame_encoder* e) {
+	assert(e);
+	pthread_mutex_lock(&e->lock);
+	if(!e->free_len) {
+		double begin = monotonic_seconds();
+		while(!e->free_len) pthread_cond_wait(&e->buffer_freed, &e->lock);
+		e->stats.stall_seconds += monotonic_seconds() - begin;
+	}
+	uint8_t* pixels = e->failed ? NULL : e->free_buffers[--e->free_len];
+	pthread_mutex_unlock(&e->lock);
+	return pixels;
+}
+
+void frame_encoder_submit(struct frame_encoder* e, uint8_t* pixels, uint32_t index) {
+	assert(e && pixels);
+	pthread_mutex_lock(&e->lock);
+	assert(e->queue_len < e->stats.depth);
+	e->queue[(e->queue_first + e->queue_len) % e->stats.depth] = (struct frame_encoder_item){pixels, index};
+	e->queue_len++;
+	e->stats.frames++;
+	if(e->queue_len > e->stats.queued_high_water) e->stats.queued_high_water = e->queue_len;
+	pthread_cond_signal(&e->frame_queued);
+	pthread_mutex_unlock(&e->lock);
+}
+
+// Waits for the queued frames to be written and frees the encoder, false if any failed
+bool frame_encoder_finish(struct frame_encoder* e, struct frame_encoder_stats* stats) {
+	assert(e);
+	pthread_mutex_lock(&e->lock);
+	e->closing = true;
+	pthread_cond_broadcast(&e->frame_queued);
+	pthread_mutex_unlock(&e->lock);
+	for(uint32_t t = 0; t < e->stats.threads; t++) pthread_join(e->threads[t], NULL);
+	
+	bool success = !e->failed;
+	if(stats) *stats = e->stats;
+	
+	pthread_cond_destroy(&e->buffer_freed);
+	pthread_cond_destroy(&e->frame_queued);
+	pthread_mutex_destroy(&e->lock);
+	free(e->threads);
+	free(e->queue);
+	free(e->free_buffers);
+	free(e->storage);
+	free(e);
+	return success;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "png.h"
+
+// Seconds spent compressing and writing images, summed over threads
+struct encode_times {
+	double encode_seconds;
+	double write_seconds;
+};
+
+// Pixels are bottom-up like glReadPixels
+bool png_write_file(const char* path, const uint8_t* pixels, uint32_t width, uint32_t height, enum png_compression compression, uint32_t threads, struct encode_times* times);
+bool frame_write_file(const char* outdir, uint32_t index, const uint8_t* pixels, uint32_t width, uint32_t height, enum png_compression compression, struct encode_times* times);
+bool frame_repeat_file(const char* outdir, uint32_t index, uint32_t count, struct encode_times* times);
+
+// Streams a PNG into a file as its rows are given, so a sprite sheet never has to be resident
+struct png_file_stream {
+	const char* path;
+	FILE* file;
+	struct png_buffer buffer; // encoded bytes waiting to be written
+	struct png_stream* png;
+	bool failed;
+	struct encode_times times;
+};
+
+bool png_file_stream_begin(struct png_file_stream* s, const char* path, uint32_t width, uint32_t height, enum png_compression compression, uint32_t threads);
+void png_file_stream_rows(struct png_file_stream* s, const uint8_t* rows, uint32_t count, ptrdiff_t stride); // top-down
+bool png_file_stream_end(struct png_file_stream* s);
+
+// Raw frames for an external encoder, each written in full before the next is rendered.
+// A reader that falls behind blocks the writes, throttling the export rather than buffering frames.
+enum frame_stream_format {
+	FRAME_STREAM_RGBA, // headerless RGBA8 rows top-down
+	FRAME_STREAM_Y4M // YUV4MPEG2 with an alpha plane, BT.601 limited range 4:4:4
+};
+
+struct frame_stream {
+	const char* path;
+	int fd;
+	bool close_fd; // false when writing to stdout
+	enum frame_stream_format format;
+	uint32_t width;
+	uint32_t height;
+	uint8_t* planes; // Y4M frames converted from RGBA
+	bool failed;
+	struct encode_times times;
+};
+
+bool frame_stream_begin(struct frame_stream* s, const char* path, uint32_t width, uint32_t height, float fps, enum frame_stream_format format); // "-" is stdout
+bool frame_stream_write(struct frame_stream* s, const uint8_t* pixels, uint32_t count); // bottom-up, written `count` times
+bool frame_stream_end(struct frame_stream* s);
+
+struct frame_encoder_stats {
+	uint32_t frames;
+	uint32_t threads;
+	uint32_t depth; // frame buffers cycling between the producer and the encoders
+	uint32_t queued_high_water; // most frames waiting for an encoder at once
+	double stall_seconds; // producer blocked waiting for a free buffer
+	struct encode_times times;
+};
+
+struct frame_encoder_item {
+	uint8_t* pixels;
+	uint32_t index;
+};
+
+// Bounded producer/consumer pipeline writing frames as numbered PNGs on a pool of threads.
+// Buffers are recycled, so memory stays at `depth` frames however many are written.
+struct frame_encoder {
+	const char* outdir;
+	uint32_t width;
+	uint32_t height;
+	enum png_compression compression;
+	
+	uint8_t* storage;
+	uint8_t** free_buffers;
+	uint32_t free_len;
+	struct frame_encoder_item* queue; // ring of submitted frames
+	uint32_t queue_first;
+	uint32_t queue_len;
+	
+	pthread_t* threads;
+	pthread_mutex_t lock;
+	pthread_cond_t frame_queued;
+	pthread_cond_t buffer_freed;
+	bool closing;
+	bool failed;
+	
+	struct frame_encoder_stats stats;
+};
+
+struct frame_encoder* frame_encoder_init(const char* outdir, uint32_t width, uint32_t height, enum png_compression compression, uint32_t threads, uint32_t depth);
+uint8_t* frame_encoder_acquire(struct frame_encoder* e);
+void frame_encoder_submit(struct frame_encoder* e, uint8_t* pixels, uint32_t index);
+bool frame_encoder_finish(struct frame_encoder* e, struct frame_encoder_stats* stats);
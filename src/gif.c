@@ -0,0 +1,358 @@
+#include "gif.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "util.h"
+
+#define GIF_TRANSPARENT 255 // unchanged pixels inside a frame's rectangle
+#define GIF_MAX_RAMPS 254 // entries between the background at 0 and the transparent index
+#define GIF_MAX_RAMP_STEPS 64
+#define GIF_CACHE_SIZE 4096
+#define GIF_MAX_CODES 4096
+#define GIF_DICTIONARY_SIZE 8192 // open addressed, twice the codes LZW may define
+
+struct gif_cache_entry {
+	uint32_t rgb; // with the top byte set once filled
+	uint8_t index;
+};
+
+struct gif_file {
+	const char* path;
+	FILE* file;
+	bool failed;
+	uint32_t width;
+	uint32_t height;
+	uint32_t frames;
+	
+	uint8_t palette[256][3];
+	uint8_t background[3];
+	int32_t ramp_deltas[GIF_MAX_RAMPS][3]; // from the background to each colour
+	int64_t ramp_lengths[GIF_MAX_RAMPS]; // squared
+	uint32_t ramps_len;
+	uint32_t ramp_steps; // entries per ramp, the background itself not counted
+	struct gif_cache_entry cache[GIF_CACHE_SIZE];
+	
+	uint8_t* previous; // palette indices of the frame before
+	uint8_t* current;
+	
+	// LZW state, codes are packed into sub-blocks in `out` before each frame is written
+	int32_t dictionary_keys[GIF_DICTIONARY_SIZE]; // prefix code << 8 | next index, -1 when empty
+	uint16_t dictionary_codes[GIF_DICTIONARY_SIZE];
+	uint32_t bits;
+	uint32_t bits_len;
+	uint8_t block[255];
+	uint32_t block_len;
+	uint8_t* out;
+	size_t out_len;
+	size_t out_cap;
+	
+	struct encode_times times;
+};
+
+static void push_bytes(struct gif_file* g, const void* data, size_t len) {
+	if(g->out_len + len > g->out_cap) {
+		size_t cap = g->out_cap ? g->out_cap : 4096;
+		while(cap < g->out_len + len) cap *= 2;
+		g->out = realloc(g->out, cap);
+		assert(g->out);
+		g->out_cap = cap;
+	}
+	memcpy(g->out + g->out_len, data, len);
+	g->out_len += len;
+}
+
+static void push_u16(struct gif_file* g, uint32_t value) {
+	uint8_t bytes[2] = {value, value >> 8};
+	push_bytes(g, bytes, 2);
+}
+
+// Writes out whatever has been encoded so far
+static void flush_out(struct gif_file* g) {
+	double begin = monotonic_seconds();
+	if(!g->failed && g->out_len && fwrite(g->out, 1, g->out_len, g->file) != g->out_len) {
+		fprintf(stderr, "Could not write output file %s\nError: %s\n", g->path, strerror(errno));
+		g->failed = true;
+	}
+	g->out_len = 0;
+	g->times.write_seconds += monotonic_seconds() - begin;
+}
+
+struct colour_count {
+	uint8_t rgb[3];
+	uint32_t count;
+};
+
+static int compare_colour_count(const void* a, const void* b) {
+	const struct colour_count* ca = a;
+	const struct colour_count* cb = b;
+	if(ca->count != cb->count) return ca->count < cb->count ? 1 : -1;
+	return memcmp(ca->rgb, cb->rgb, 3);
+}
+
+// Index 0 is the background, then a ramp of evenly spaced blends towards each colour, most common first.
+// Antialiased and faded strokes over the background land on their colour's ramp.
+static void build_palette(struct gif_file* g, const uint8_t (*colors)[3], uint32_t colors_len) {
+	struct colour_count* counts = malloc(sizeof(struct colour_count) * (colors_len ? colors_len : 1));
+	assert(counts);
+	uint32_t counts_len = 0;
+	for(uint32_t c = 0; c < colors_len; c++) {
+		if(!memcmp(colors[c], g->background, 3)) continue;
+		uint32_t i = 0;
+		while(i < counts_len && memcmp(counts[i].rgb, colors[c], 3)) i++;
+		if(i == counts_len) counts[counts_len++] = (struct colour_count){{colors[c][0], colors[c][1], colors[c][2]}, 0};
+		counts[i].count++;
+	}
+	qsort(counts, counts_len, sizeof(struct colour_count), compare_colour_count);
+	
+	g->ramps_len = counts_len < GIF_MAX_RAMPS ? counts_len : GIF_MAX_RAMPS;
+	g->ramp_steps = g->ramps_len ? GIF_MAX_RAMPS / g->ramps_len : 0;
+	if(g->ramp_steps > GIF_MAX_RAMP_STEPS) g->ramp_steps = GIF_MAX_RAMP_STEPS;
+	
+	memset(g->palette, 0, sizeof(g->palette));
+	memcpy(g->palette[0], g->background, 3);
+	for(uint32_t r = 0; r < g->ramps_len; r++) {
+		g->ramp_lengths[r] = 0;
+		for(int c = 0; c < 3; c++) {
+			g->ramp_deltas[r][c] = (int32_t)counts[r].rgb[c] - g->background[c];
+			g->ramp_lengths[r] += (int64_t)g->ramp_deltas[r][c] * g->ramp_deltas[r][c];
+		}
+		for(uint32_t k = 1; k <= g->ramp_steps; k++) {
+			for(int c = 0; c < 3; c++) {
+				int32_t offset = g->ramp_deltas[r][c] * (int32_t)k;
+				offset = offset >= 0 ? (offset + (int32_t)g->ramp_steps/2) / (int32_t)g->ramp_steps : -((-offset + (int32_t)g->ramp_steps/2) / (int32_t)g->ramp_steps);
+				g->palette[1 + r * g->ramp_steps + (k-1)][c] = g->background[c] + offset;
+			}
+		}
+	}
+	free(counts);
+}
+
+static inline uint32_t colour_distance(const uint8_t* a, const uint8_t* b) {
+	int32_t dr = (int32_t)a[0] - b[0], dg = (int32_t)a[1] - b[1], db = (int32_t)a[2] - b[2];
+	return dr*dr + dg*dg + db*db;
+}
+
+// The background or the nearest step of whichever ramp the colour projects closest to
+static uint8_t nearest_index(struct gif_file* g, const uint8_t* rgb) {
+	uint32_t key = 0xFF000000u | rgb[0] << 16 | rgb[1] << 8 | rgb[2];
+	struct gif_cache_entry* entry = &g->cache[(key * 2654435761u) >> 20];
+	if(entry->rgb == key) return entry->index;
+	
+	uint8_t best = 0;
+	uint32_t best_distance = colour_distance(rgb, g->background);
+	for(uint32_t r = 0; r < g->ramps_len && best_distance; r++) {
+		int64_t along = 0;
+		for(int c = 0; c < 3; c++) along += (int64_t)((int32_t)rgb[c] - g->background[c]) * g->ramp_deltas[r][c];
+		if(along <= 0) continue;
+		
+		int64_t k = (along * g->ramp_steps * 2 + g->ramp_lengths[r]) / (g->ramp_lengths[r] * 2);
+		if(k < 1) k = 1;
+		if(k > g->ramp_steps) k = g->ramp_steps;
+		uint8_t index = 1 + r * g->ramp_steps + (uint32_t)(k-1);
+		uint32_t distance = colour_distance(rgb, g->palette[index]);
+		if(distance < best_distance) {
+			best = index;
+			best_distance = distance;
+		}
+	}
+	
+	*entry = (struct gif_cache_entry){key, best};
+	return best;
+}
+
+struct gif_file* gif_file_begin(const char* path, uint32_t width, uint32_t height, const uint8_t (*colors)[3], uint32_t colors_len, const uint8_t background[3]) {
+	assert(width && height && width <= UINT16_MAX && height <= UINT16_MAX);
+	FILE* file = fopen(path, "wb");
+	if(!file) {
+		fprintf(stderr, "Could not open output file %s\nError: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	
+	struct gif_file* g = calloc(1, sizeof(struct gif_file));
+	assert(g);
+	g->path = path;
+	g->file = file;
+	g->width = width;
+	g->height = height;
+	memcpy(g->background, background, 3);
+	g->previous = malloc((size_t)width * height);
+	g->current = malloc((size_t)width * height);
+	assert(g->previous && g->current);
+	
+	double begin = monotonic_seconds();
+	build_palette(g, colors, colors_len);
+	
+	push_bytes(g, "GIF89a", 6);
+	push_u16(g, width);
+	push_u16(g, height);
+	push_bytes(g, (uint8_t[]){0xF7, 0, 0}, 3); // a global table of 256 colours, the background at 0, square pixels
+	push_bytes(g, g->palette, sizeof(g->palette));
+	push_bytes(g, (uint8_t[]){0x21, 0xFF, 11}, 3);
+	push_bytes(g, "NETSCAPE2.0", 11);
+	push_bytes(g, (uint8_t[]){3, 1, 0, 0, 0}, 5); // loop forever
+	g->times.encode_seconds += monotonic_seconds() - begin;
+	flush_out(g);
+	return g;
+}
+
+static void push_block(struct gif_file* g) {
+	if(!g->block_len) return;
+	uint8_t len = g->block_len;
+	push_bytes(g, &len, 1);
+	push_bytes(g, g->block, g->block_len);
+	g->block_len = 0;
+}
+
+static inline void put_code(struct gif_file* g, uint32_t code, uint32_t size) {
+	g->bits |= code << g->bits_len;
+	g->bits_len += size;
+	while(g->bits_len >= 8) {
+		g->block[g->block_len++] = g->bits;
+		if(g->block_len == sizeof(g->block)) push_block(g);
+		g->bits >>= 8;
+		g->bits_len -= 8;
+	}
+}
+
+// LZW codes for the rectangle's indices as data sub-blocks, starting afresh every time the code space fills up
+static void push_lzw(struct gif_file* g, uint32_t left, uint32_t top, uint32_t width, uint32_t height, bool delta) {
+	const uint32_t clear = 256, end = 257;
+	uint32_t size = 9, next = end + 1;
+	memset(g->dictionary_keys, 0xFF, sizeof(g->dictionary_keys));
+	g->bits = 0;
+	g->bits_len = 0;
+	g->block_len = 0;
+	
+	push_bytes(g, (uint8_t[]){8}, 1);
+	put_code(g, clear, size);
+	int32_t prefix = -1;
+	bool first = true; // no code written since the last clear
+	for(uint32_t y = top; y < top + height; y++) {
+		const uint8_t* row = g->current + (size_t)y * g->width;
+		const uint8_t* previous = g->previous + (size_t)y * g->width;
+		for(uint32_t x = left; x < left + width; x++) {
+			uint8_t index = delta && row[x] == previous[x] ? GIF_TRANSPARENT : row[x];
+			if(prefix < 0) {
+				prefix = index;
+				continue;
+			}
+			
+			int32_t key = prefix << 8 | index;
+			uint32_t slot = ((uint32_t)key * 2654435761u) >> 19;
+			while(g->dictionary_keys[slot] >= 0 && g->dictionary_keys[slot] != key) slot = (slot + 1) & (GIF_DICTIONARY_SIZE-1);
+			if(g->dictionary_keys[slot] == key) {
+				prefix = g->dictionary_codes[slot];
+				continue;
+			}
+			
+			put_code(g, prefix, size);
+			first = false;
+			g->dictionary_keys[slot] = key;
+			g->dictionary_codes[slot] = next++;
+			if(next > (1u << size)) size++;
+			if(next == GIF_MAX_CODES) {
+				put_code(g, clear, size);
+				memset(g->dictionary_keys, 0xFF, sizeof(g->dictionary_keys));
+				size = 9;
+				next = end + 1;
+				first = true;
+			}
+			prefix = index;
+		}
+	}
+	// The decoder defines one more code on reading the last, and may widen before the end code
+	put_code(g, prefix, size);
+	if(!first && next < GIF_MAX_CODES && ++next > (1u << size)) size++;
+	put_code(g, end, size);
+	if(g->bits_len) put_code(g, 0, 8 - g->bits_len);
+	push_block(g);
+	push_bytes(g, (uint8_t[]){0}, 1);
+}
+
+bool gif_file_frame(struct gif_file* g, const uint8_t* pixels, ptrdiff_t stride, uint32_t delay) {
+	assert(g);
+	double begin = monotonic_seconds();
+	
+	// Flattened the same way as removing the alpha over a background colour
+	for(uint32_t y = 0; y < g->height; y++) {
+		const uint8_t* row = pixels + stride * (ptrdiff_t)y;
+		uint8_t* indices = g->current + (size_t)y * g->width;
+		for(uint32_t x = 0; x < g->width; x++) {
+			const uint8_t* p = row + x * 4;
+			uint8_t rgb[3];
+			for(int c = 0; c < 3; c++) rgb[c] = (p[c] * p[3] + g->background[c] * (255 - p[3]) + 127) / 255;
+			indices[x] = nearest_index(g, rgb);
+		}
+	}
+	
+	// Only the rectangle around what changed is stored, the rest of the frame before stays on screen
+	uint32_t left = 0, top = 0, right = g->width, bottom = g->height;
+	bool delta = g->frames > 0;
+	if(delta) {
+		left = g->width;
+		right = 0;
+		bottom = 0;
+		top = g->height;
+		for(uint32_t y = 0; y < g->height; y++) {
+			const uint8_t* row = g->current + (size_t)y * g->width;
+			const uint8_t* previous = g->previous + (size_t)y * g->width;
+			if(!memcmp(row, previous, g->width)) continue;
+			if(y < top) top = y;
+			bottom = y + 1;
+			
+			uint32_t first = 0, last = g->width;
+			while(row[first] == previous[first]) first++;
+			while(row[last-1] == previous[last-1]) last--;
+			if(first < left) left = first;
+			if(last > right) right = last;
+		}
+		if(!bottom) { // nothing changed, a single transparent pixel carries the delay
+			left = top = 0;
+			right = bottom = 1;
+		}
+	}
+	
+	push_bytes(g, (uint8_t[]){0x21, 0xF9, 4, 1 << 2 | delta}, 4); // left in place for the next frame to draw over
+	push_u16(g, delay > UINT16_MAX ? UINT16_MAX : delay);
+	push_bytes(g, (uint8_t[]){GIF_TRANSPARENT, 0}, 2);
+	push_bytes(g, (uint8_t[]){0x2C}, 1);
+	push_u16(g, left);
+	push_u16(g, top);
+	push_u16(g, right - left);
+	push_u16(g, bottom - top);
+	push_bytes(g, (uint8_t[]){0}, 1);
+	push_lzw(g, left, top, right - left, bottom - top, delta);
+	
+	uint8_t* swap = g->previous;
+	g->previous = g->current;
+	g->current = swap;
+	g->frames++;
+	g->times.encode_seconds += monotonic_seconds() - begin;
+	flush_out(g);
+	return !g->failed;
+}
+
+bool gif_file_end(struct gif_file* g, struct encode_times* times) {
+	assert(g);
+	push_bytes(g, (uint8_t[]){0x3B}, 1);
+	flush_out(g);
+	if(fclose(g->file) != 0 && !g->failed) {
+		fprintf(stderr, "Could not write output file %s\n", g->path);
+		g->failed = true;
+	}
+	
+	bool success = !g->failed;
+	if(times) {
+		times->encode_seconds += g->times.encode_seconds;
+		times->write_seconds += g->times.write_seconds;
+	}
+	free(g->out);
+	free(g->current);
+	free(g->previous);
+	free(g);
+	return success;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "encoder.h"
+
+// Writes an animated GIF into a file a frame at a time.
+// Frames are flattened over `background` and mapped to a palette of ramps from it towards each of `colors`,
+// which may repeat; the most common are kept if they do not all fit. Every frame after the first only stores
+// the rectangle that changed since the one before, leaving the pixels in it that did not change transparent.
+struct gif_file;
+
+struct gif_file* gif_file_begin(const char* path, uint32_t width, uint32_t height, const uint8_t (*colors)[3], uint32_t colors_len, const uint8_t background[3]);
+bool gif_file_frame(struct gif_file* g, const uint8_t* pixels, ptrdiff_t stride, uint32_t delay); // RGBA8 rows top-down, delay in hundredths of a second
+bool gif_file_end(struct gif_file* g, struct encode_times* times); // frees the file, false if any of it failed to write
@@ -1,44 +1,481 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <signal.h>
+#include <glob.h>
+#include <libgen.h>
+#include <sys/stat.h>
 
 /* --- Must be included in this order --- */
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 /* -------------------------------------- */
 
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 #include "app.h"
 #include "util.h"
+#include "strokes.h"
 
 static GLFWwindow* window = NULL;
 static double last_time = 0;
 
+enum export_status {
+	EXPORT_STATUS_OK = 0,
+	EXPORT_STATUS_USAGE,
+	EXPORT_STATUS_OPEN_FAILED,
+	EXPORT_STATUS_NO_ARTBOARD,
+	EXPORT_STATUS_NO_CONTEXT,
+	EXPORT_STATUS_EXPORT_FAILED,
+	EXPORT_STATUS_DUPLICATE_OUTPUT,
+};
+
+struct export_args {
+	const char* in;
+	const char* out; // a directory of outputs in batch mode
+	char** batch; // .line files exported one after another, sharing the context and brushes
+	uint32_t batch_len;
+	uint32_t batch_cap;
+	bool batch_mode;
+	float fps; // 0 uses the fps stored in the file
+	bool print_stats;
+	bool include_css;
+	enum lb_sheet_layout layout;
+	bool y4m;
+	struct lb_export_options options;
+};
+
 static void handleGLFWError(int error, const char* description) {
 	fprintf(stderr, "GLFW Error %d: %s\n", error, description);
 }
 
 void close_app() {
-	glfwSetWindowShouldClose(window, 1);
+	if(window) glfwSetWindowShouldClose(window, 1);
+}
+
+static void setContextHints() {
+	// OpenGL Context Version
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	
+	#ifdef DEBUG
+	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+	#endif
+}
+
+static void printUsage(const char* exec) {
+	fprintf(stderr, "Usage: %s [--export in.line | --batch file.line|'glob'|@list.txt ...] --out path [--type spritesheet|sequence|gif|raw] [--layout strip|grid|atlas] [--y4m] [--fps N] [--2x] [--css] [--software] [--threads N] [--compression fast|balanced|smallest] [--manifest] [--stats]\n", exec);
+}
+
+static void addBatchFile(struct export_args* args, const char* path) {
+	if(args->batch_len == args->batch_cap) {
+		uint32_t cap = args->batch_cap ? args->batch_cap * 2 : 16;
+		char** batch = realloc(args->batch, sizeof(char*) * cap);
+		assert(batch);
+		args->batch = batch;
+		args->batch_cap = cap;
+	}
+	char* copy = strdup(path);
+	assert(copy);
+	args->batch[args->batch_len++] = copy;
+}
+
+// One --batch argument: @list.txt names a file per line, anything else is globbed (kept as is when nothing matches)
+static bool addBatchFiles(struct export_args* args, const char* pattern) {
+	if(pattern[0] == '@') {
+		FILE* list = fopen(pattern + 1, "r");
+		if(!list) {
+			fprintf(stderr, "Could not open batch list %s\nError: %s\n", pattern + 1, strerror(errno));
+			return false;
+		}
+		char line[4096];
+		while(fgets(line, sizeof(line), list)) {
+			// A line that does not fit would otherwise come back as several bogus paths
+			if(!strchr(line, '\n') && !feof(list)) {
+				fprintf(stderr, "Line too long in batch list %s\n", pattern + 1);
+				fclose(list);
+				return false;
+			}
+			line[strcspn(line, "\r\n")] = '\0';
+			if(line[0] && line[0] != '#') addBatchFile(args, line);
+		}
+		fclose(list);
+		return true;
+	}
+	
+	glob_t matches;
+	if(glob(pattern, GLOB_NOCHECK, NULL, &matches) != 0) {
+		fprintf(stderr, "Could not expand %s\n", pattern);
+		return false;
+	}
+	for(size_t m = 0; m < matches.gl_pathc; m++) addBatchFile(args, matches.gl_pathv[m]);
+	globfree(&matches);
+	return true;
+}
+
+static void freeExportArgs(struct export_args* args) {
+	for(uint32_t i = 0; i < args->batch_len; i++) free(args->batch[i]);
+	free(args->batch);
+}
+
+static bool parseExportArgs(int argc, char** argv, struct export_args* args) {
+	*args = (struct export_args){0};
+	args->options.type = EXPORT_SPRITESHEET;
+	
+	for(int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+		
+		if(strcmp(arg, "--2x") == 0) {
+			args->options.retina_2x = true;
+			continue;
+		} else if(strcmp(arg, "--css") == 0) {
+			args->include_css = true;
+			continue;
+		} else if(strcmp(arg, "--software") == 0) {
+			args->options.software = true;
+			continue;
+		} else if(strcmp(arg, "--y4m") == 0) {
+			args->y4m = true;
+			continue;
+		} else if(strcmp(arg, "--manifest") == 0) {
+			args->options.manifest = true;
+			continue;
+		} else if(strcmp(arg, "--stats") == 0) {
+			args->print_stats = true;
+			continue;
+		} else if(strcmp(arg, "--batch") == 0) {
+			args->batch_mode = true;
+			for(; i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0; i++) {
+				if(!addBatchFiles(args, argv[i + 1])) return false;
+			}
+			continue;
+		}
+		
+		if(!value) {
+			fprintf(stderr, "Missing value for %s\n", arg);
+			return false;
+		}
+		i++;
+		
+		if(strcmp(arg, "--export") == 0) {
+			args->in = value;
+		} else if(strcmp(arg, "--out") == 0) {
+			args->out = value;
+		} else if(strcmp(arg, "--type") == 0) {
+			if(strcmp(value, "spritesheet") == 0) args->options.type = EXPORT_SPRITESHEET;
+			else if(strcmp(value, "sequence") == 0) args->options.type = EXPORT_IMAGE_SEQUENCE;
+			else if(strcmp(value, "gif") == 0) args->options.type = EXPORT_GIF;
+			else if(strcmp(value, "raw") == 0) args->options.type = EXPORT_RAW_STREAM;
+			else {
+				fprintf(stderr, "Unknown export type %s\n", value);
+				return false;
+			}
+		} else if(strcmp(arg, "--layout") == 0) {
+			if(strcmp(value, "strip") == 0) args->layout = SHEET_LAYOUT_STRIP;
+			else if(strcmp(value, "grid") == 0) args->layout = SHEET_LAYOUT_GRID;
+			else if(strcmp(value, "atlas") == 0) args->layout = SHEET_LAYOUT_ATLAS;
+			else {
+				fprintf(stderr, "Unknown sprite sheet layout %s\n", value);
+				return false;
+			}
+		} else if(strcmp(arg, "--compression") == 0) {
+			if(strcmp(value, "fast") == 0) args->options.compression = PNG_COMPRESSION_FAST;
+			else if(strcmp(value, "balanced") == 0) args->options.compression = PNG_COMPRESSION_BALANCED;
+			else if(strcmp(value, "smallest") == 0) args->options.compression = PNG_COMPRESSION_SMALLEST;
+			else {
+				fprintf(stderr, "Unknown compression %s\n", value);
+				return false;
+			}
+		} else if(strcmp(arg, "--threads") == 0) {
+			char* end;
+			long threads = strtol(value, &end, 10);
+			if(end == value || *end != '\0' || threads < 0 || threads > 256) {
+				fprintf(stderr, "Invalid thread count %s, expected 1 to 256 or 0 for every core\n", value);
+				return false;
+			}
+			args->options.threads = (uint32_t)threads;
+		} else if(strcmp(arg, "--fps") == 0) {
+			char* end;
+			args->fps = strtof(value, &end);
+			if(*end != '\0' || args->fps <= 0) {
+				fprintf(stderr, "Invalid fps %s\n", value);
+				return false;
+			}
+		} else {
+			fprintf(stderr, "Unknown option %s\n", arg);
+			return false;
+		}
+	}
+	
+	if(args->batch_mode) {
+		if(args->in || !args->out) {
+			fprintf(stderr, "--batch takes an --out directory instead of --export\n");
+			return false;
+		}
+		if(!args->batch_len) {
+			fprintf(stderr, "--batch was given no files\n");
+			return false;
+		}
+	} else if(!args->in || !args->out) {
+		fprintf(stderr, "Both --export and --out are required\n");
+		return false;
+	}
+	
+	// The per-type options share storage, so only the chosen type's are set
+	if(args->options.type == EXPORT_SPRITESHEET) {
+		args->options.spritesheet.include_css = args->include_css;
+		args->options.spritesheet.layout = args->layout;
+	}
+	if(args->options.type == EXPORT_RAW_STREAM) args->options.raw_stream.y4m = args->y4m;
+	return true;
+}
+
+static bool hasArg(int argc, char** argv, const char* name) {
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], name) == 0) return true;
+	}
+	return false;
+}
+
+#ifdef __linux__
+// Build servers have no display, so export runs on a surfaceless EGL context instead of a window
+static EGLDisplay headless_display = EGL_NO_DISPLAY;
+static EGLContext headless_context = EGL_NO_CONTEXT;
+
+static bool createHeadlessContext() {
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if(getPlatformDisplay) headless_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if(headless_display == EGL_NO_DISPLAY) headless_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if(headless_display == EGL_NO_DISPLAY || !eglInitialize(headless_display, NULL, NULL)) {
+		fprintf(stderr, "Could not initialize EGL display.\n");
+		return false;
+	}
+	
+	if(!eglBindAPI(EGL_OPENGL_API)) {
+		fprintf(stderr, "Could not bind the OpenGL API.\n");
+		return false;
+	}
+	
+	const EGLint attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 2,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	headless_context = eglCreateContext(headless_display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+	if(headless_context == EGL_NO_CONTEXT || !eglMakeCurrent(headless_display, EGL_NO_SURFACE, EGL_NO_SURFACE, headless_context)) {
+		fprintf(stderr, "Could not create a surfaceless OpenGL context.\n");
+		return false;
+	}
+	
+	// GLEW's GLX setup has no display to query here, the GL entry points are loaded before it fails
+	GLenum glewError = glewInit();
+	if(glewError != GLEW_OK && glewError != GLEW_ERROR_NO_GLX_DISPLAY) {
+		fprintf(stderr, "Could not initialize GLEW: %s\n", glewGetErrorString(glewError));
+		return false;
+	}
+	glGetError();
+	return true;
+}
+
+static void destroyHeadlessContext() {
+	if(headless_display == EGL_NO_DISPLAY) return;
+	eglMakeCurrent(headless_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if(headless_context != EGL_NO_CONTEXT) eglDestroyContext(headless_display, headless_context);
+	eglTerminate(headless_display);
+}
+#else
+static bool createHeadlessContext() {
+	glfwSetErrorCallback(handleGLFWError);
+	if(!glfwInit()) return false;
+	
+	setContextHints();
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	
+	window = glfwCreateWindow(1, 1, "Linebaby", NULL, NULL);
+	if(!window) {
+		fprintf(stderr, "Could not create a hidden GLFW window.\n");
+		return false;
+	}
+	glfwMakeContextCurrent(window);
+	
+	GLenum glewError = glewInit();
+	if(glewError != GLEW_OK) {
+		fprintf(stderr, "Could not initialize GLEW: %s\n", glewGetErrorString(glewError));
+		return false;
+	}
+	return true;
+}
+
+static void destroyHeadlessContext() {
+	glfwTerminate();
+}
+#endif
+
+// The context, shaders and brushes every export shares, set up once however many files are exported
+static bool initExport(bool software) {
+	if(software) {
+		lb_strokes_init_headless();
+		return true;
+	}
+	if(createHeadlessContext()) {
+		lb_strokes_init();
+		return true;
+	}
+	destroyHeadlessContext();
+	return false;
+}
+
+static int exportFile(const struct export_args* args, const char* in, const char* out, struct lb_export_stats* stats) {
+	if(!lb_strokes_open(in)) return EXPORT_STATUS_OPEN_FAILED;
+	
+	if(!lb_strokes_artboard_set) {
+		fprintf(stderr, "%s has no artboard set.\n", in);
+		return EXPORT_STATUS_NO_ARTBOARD;
+	}
+	
+	if(!lb_strokes_export_range_set) {
+		lb_strokes_export_range_begin = 0;
+		lb_strokes_export_range_duration = lb_strokes_timelineDuration;
+		lb_strokes_export_range_set = true;
+	}
+	
+	if(args->options.type == EXPORT_IMAGE_SEQUENCE && mkdir(out, 0755) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Could not create output directory %s\nError: %s\n", out, strerror(errno));
+		return EXPORT_STATUS_EXPORT_FAILED;
+	}
+	
+	float fps = args->fps > 0 ? args->fps : lb_strokes_export_fps;
+	struct lb_export_options options = args->options;
+	options.stats = stats;
+	if(!lb_strokes_render_export(out, fps, options)) return EXPORT_STATUS_EXPORT_FAILED;
+	return EXPORT_STATUS_OK;
+}
+
+static void printStats(const struct lb_export_stats* stats) {
+	fprintf(stderr, "%u frames (%u repeated) in %.3fs on %u threads\n", stats->frames, stats->duplicate_frames, stats->total_seconds, stats->threads);
+	fprintf(stderr, "render %.3fs, encode %.3fs, write %.3fs (summed over threads)\n", stats->render_seconds, stats->encode_seconds, stats->write_seconds);
+	if(stats->queue_depth) fprintf(stderr, "queue depth %u, high water %u, renderer stalled %.3fs\n", stats->queue_depth, stats->queue_high_water, stats->stall_seconds);
+}
+
+static int runExport(const struct export_args* args) {
+	if(!initExport(args->options.software)) return EXPORT_STATUS_NO_CONTEXT;
+	
+	// A reader closing a raw stream early fails the export instead of killing it
+	if(args->options.type == EXPORT_RAW_STREAM) signal(SIGPIPE, SIG_IGN);
+	
+	struct lb_export_stats stats = {0};
+	int status = exportFile(args, args->in, args->out, &stats);
+	if(args->print_stats && (status == EXPORT_STATUS_OK || status == EXPORT_STATUS_EXPORT_FAILED)) printStats(&stats);
+	
+	if(!args->options.software) destroyHeadlessContext();
+	return status;
+}
+
+// Exports every file of the batch into the --out directory, named after the file with the type's extension.
+// Documents are global state, so files go one at a time, each rendering and encoding its frames on every core.
+// Prints a line per file as it finishes and a summary, returning the status of the first file that failed.
+static int runBatch(const struct export_args* args) {
+	static const char* status_names[] = {"ok", "usage", "open failed", "no artboard", "no context", "export failed", "duplicate out"};
+	static const char* extensions[] = {".png", "", ".gif", ".rgba"};
+	
+	double begin = monotonic_seconds();
+	if(!initExport(args->options.software)) return EXPORT_STATUS_NO_CONTEXT;
+	if(args->options.type == EXPORT_RAW_STREAM) signal(SIGPIPE, SIG_IGN);
+	
+	int status = EXPORT_STATUS_OK;
+	uint32_t failed = 0, frames = 0;
+	bool out_ready = mkdir(args->out, 0755) == 0 || errno == EEXIST;
+	if(!out_ready) {
+		fprintf(stderr, "Could not create output directory %s\nError: %s\n", args->out, strerror(errno));
+		status = EXPORT_STATUS_EXPORT_FAILED;
+		failed = args->batch_len;
+	}
+	
+	// Inputs from different directories can share a name, and would overwrite each other's output
+	char** outs = calloc(args->batch_len ? args->batch_len : 1, sizeof(char*));
+	assert(outs);
+	
+	for(uint32_t i = 0; i < args->batch_len && out_ready; i++) {
+		char name[4096];
+		strncpy(name, args->batch[i], sizeof(name) - 1);
+		name[sizeof(name) - 1] = '\0';
+		char* base = basename(name);
+		char* extension = strrchr(base, '.');
+		if(extension && strcmp(extension, ".line") == 0) *extension = '\0';
+		
+		char out[4096];
+		const char* type_extension = args->options.type == EXPORT_RAW_STREAM && args->options.raw_stream.y4m ? ".y4m" : extensions[args->options.type];
+		snprintf(out, sizeof(out), "%s/%s%s", args->out, base, type_extension);
+		
+		uint32_t taken = 0;
+		while(taken < i && !(outs[taken] && strcmp(outs[taken], out) == 0)) taken++;
+		if(taken < i) {
+			if(status == EXPORT_STATUS_OK) status = EXPORT_STATUS_DUPLICATE_OUTPUT;
+			failed++;
+			fprintf(stderr, "%8.3fs  %-13s %s (%s is already written from %s)\n", 0.0, status_names[EXPORT_STATUS_DUPLICATE_OUTPUT], args->batch[i], out, args->batch[taken]);
+			continue;
+		}
+		outs[i] = strdup(out);
+		assert(outs[i]);
+		
+		struct lb_export_stats stats = {0};
+		double file_begin = monotonic_seconds();
+		int file_status = exportFile(args, args->batch[i], out, &stats);
+		double seconds = monotonic_seconds() - file_begin;
+		
+		if(file_status == EXPORT_STATUS_OK) {
+			frames += stats.frames;
+			fprintf(stderr, "%8.3fs  %-13s %s -> %s (%u frames)\n", seconds, status_names[file_status], args->batch[i], out, stats.frames);
+			if(args->print_stats) printStats(&stats);
+		} else {
+			if(status == EXPORT_STATUS_OK) status = file_status;
+			failed++;
+			fprintf(stderr, "%8.3fs  %-13s %s\n", seconds, status_names[file_status], args->batch[i]);
+		}
+	}
+	
+	for(uint32_t i = 0; i < args->batch_len; i++) free(outs[i]);
+	free(outs);
+	
+	fprintf(stderr, "%u of %u files exported (%u frames), %u failed, in %.3fs\n",
+		args->batch_len - failed, args->batch_len, frames, failed, monotonic_seconds() - begin);
+	if(!args->options.software) destroyHeadlessContext();
+	return status;
 }
 
 int main(int argc, char** argv) {
 	
+	if(hasArg(argc, argv, "--export") || hasArg(argc, argv, "--batch")) {
+		struct export_args args;
+		if(!parseExportArgs(argc, argv, &args)) {
+			printUsage(argv[0]);
+			freeExportArgs(&args);
+			return EXPORT_STATUS_USAGE;
+		}
+		int status = args.batch_mode ? runBatch(&args) : runExport(&args);
+		freeExportArgs(&args);
+		return status;
+	}
+	
 	glfwSetErrorCallback(handleGLFWError);
 	if(!glfwInit()) {
 		return -1;
 	}
 	
-	// OpenGL Context Version
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	setContextHints();
 	
 	glfwWindowHint(GLFW_DOUBLEBUFFER, GL_TRUE);
 	//glfwWindowHint(GLFW_SAMPLES, 2);
 	
-	#ifdef DEBUG
-	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
-	#endif
-	
 	window = glfwCreateWindow(640, 480, "Linebaby", NULL, NULL);
 	if (!window) {
 		fprintf(stderr, "Could not initialize GLFW window.\n");
@@ -0,0 +1,835 @@
+#include "png.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// --- Buffers, checksums ---
+
+static void buffer_reserve(struct png_buffer* buf, size_t extra) {
+	if(buf->len + extra <= buf->cap) return;
+	size_t cap = buf->cap ? buf->cap : 4096;
+	while(cap < buf->len + extra) cap *= 2;
+	buf->data = realloc(buf->data, cap);
+	assert(buf->data);
+	buf->cap = cap;
+}
+
+static void buffer_push(struct png_buffer* buf, const void* data, size_t len) {
+	buffer_reserve(buf, len);
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+static void buffer_push_u32(struct png_buffer* buf, uint32_t value) {
+	uint8_t bytes[4] = {value >> 24, value >> 16, value >> 8, value};
+	buffer_push(buf, bytes, 4);
+}
+
+void png_buffer_destroy(struct png_buffer* buf) {
+	free(buf->data);
+	*buf = (struct png_buffer){0};
+}
+
+struct huffman {
+	uint8_t lengths[288];
+	uint16_t codes[288]; // bit reversed, ready to write
+};
+
+static uint32_t crc_table[256];
+static uint8_t length_codes[259]; // match length - 257 for lengths 3..258
+static uint8_t distance_codes[512]; // distance-1 below 256, then (distance-1)>>7
+static struct huffman fixed_litlen, fixed_dist;
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static const uint16_t length_base[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const uint8_t length_extra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const uint16_t distance_base[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+static const uint8_t distance_extra[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+static const uint8_t code_length_order[19] = {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+
+static void huffman_codes(struct huffman* h, uint32_t count);
+
+static void init_tables() {
+	for(uint32_t n = 0; n < 256; n++) {
+		uint32_t c = n;
+		for(int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+		crc_table[n] = c;
+	}
+	
+	for(uint8_t code = 0; code < 29; code++) {
+		uint32_t last = code == 28 ? 258 : length_base[code] + (1u << length_extra[code]);
+		for(uint32_t len = length_base[code]; len < last && len <= 258; len++) length_codes[len] = code;
+	}
+	length_codes[258] = 28; // 258 has its own code rather than being 227 + 31
+	
+	for(uint8_t code = 0; code < 30; code++) {
+		for(uint32_t d = distance_base[code]; d < distance_base[code] + (1u << distance_extra[code]); d++) {
+			if(d <= 256) distance_codes[d-1] = code;
+			else distance_codes[256 + ((d-1) >> 7)] = code;
+		}
+	}
+	
+	for(uint32_t s = 0; s < 288; s++) fixed_litlen.lengths[s] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+	for(uint32_t s = 0; s < 30; s++) fixed_dist.lengths[s] = 5;
+	huffman_codes(&fixed_litlen, 288);
+	huffman_codes(&fixed_dist, 30);
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t len) {
+	crc = ~crc;
+	for(size_t i = 0; i < len; i++) crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+#define ADLER_BASE 65521
+
+static uint32_t adler32_update(uint32_t adler, const uint8_t* data, size_t len) {
+	uint32_t a = adler & 0xFFFF, b = adler >> 16;
+	while(len) {
+		size_t block = len < 5552 ? len : 5552; // the most bytes b can take before overflowing
+		for(size_t i = 0; i < block; i++) {
+			a += data[i];
+			b += a;
+		}
+		a %= ADLER_BASE;
+		b %= ADLER_BASE;
+		data += block;
+		len -= block;
+	}
+	return b << 16 | a;
+}
+
+// Checksum of two runs of bytes from the checksums of each, len2 being the second's length
+static uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, size_t len2) {
+	uint32_t rem = len2 % ADLER_BASE;
+	uint32_t a = adler1 & 0xFFFF;
+	uint32_t b = (rem * a) % ADLER_BASE;
+	a += (adler2 & 0xFFFF) + ADLER_BASE - 1;
+	b += (adler1 >> 16) + (adler2 >> 16) + ADLER_BASE - rem;
+	if(a >= ADLER_BASE) a -= ADLER_BASE;
+	if(a >= ADLER_BASE) a -= ADLER_BASE;
+	if(b >= ADLER_BASE * 2) b -= ADLER_BASE * 2;
+	if(b >= ADLER_BASE) b -= ADLER_BASE;
+	return b << 16 | a;
+}
+
+// --- Levels ---
+
+struct compression_level {
+	uint8_t filters; // tries filter types below this, 3 stops at Up
+	uint32_t max_chain; // match candidates looked at per position
+	uint32_t nice_length; // stop looking once a match is this long
+	bool lazy; // defer a match by a byte when the next position matches longer
+	size_t chunk_bytes; // filtered bytes per independently deflated chunk
+	uint8_t zlib_flags;
+};
+
+static const struct compression_level levels[] = {
+	[PNG_COMPRESSION_FAST] = {.filters = 3, .max_chain = 8, .nice_length = 32, .lazy = false, .chunk_bytes = 256 * 1024, .zlib_flags = 0x01},
+	[PNG_COMPRESSION_BALANCED] = {.filters = 5, .max_chain = 64, .nice_length = 128, .lazy = true, .chunk_bytes = 256 * 1024, .zlib_flags = 0x9C},
+	[PNG_COMPRESSION_SMALLEST] = {.filters = 5, .max_chain = 1024, .nice_length = 258, .lazy = true, .chunk_bytes = 1024 * 1024, .zlib_flags = 0xDA}
+};
+
+// --- Filtering ---
+
+static inline uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+	int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2*c);
+	return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// One loop per filter type so each vectorizes, the left neighbours of the first pixel being zero
+static void apply_filter(uint8_t* out, uint8_t filter, const uint8_t* row, const uint8_t* prev, size_t bytes) {
+	switch(filter) {
+		case 0:
+			memcpy(out, row, bytes);
+			break;
+		case 1:
+			for(size_t i = 0; i < 4; i++) out[i] = row[i];
+			for(size_t i = 4; i < bytes; i++) out[i] = row[i] - row[i-4];
+			break;
+		case 2:
+			for(size_t i = 0; i < bytes; i++) out[i] = row[i] - prev[i];
+			break;
+		case 3:
+			for(size_t i = 0; i < 4; i++) out[i] = row[i] - (prev[i] >> 1);
+			for(size_t i = 4; i < bytes; i++) out[i] = row[i] - ((row[i-4] + prev[i]) >> 1);
+			break;
+		case 4:
+			for(size_t i = 0; i < 4; i++) out[i] = row[i] - prev[i];
+			for(size_t i = 4; i < bytes; i++) out[i] = row[i] - paeth(row[i-4], prev[i], prev[i-4]);
+			break;
+	}
+}
+
+// Writes the filter type and filtered bytes of a row, picking the filter with the smallest sum of
+// absolute signed bytes. prev is a zero row above the first row of the image, scratch holds two rows.
+static void filter_row(uint8_t* out, const uint8_t* row, const uint8_t* prev, size_t bytes, uint8_t filters, uint8_t* scratch) {
+	uint8_t* candidate = scratch;
+	uint8_t* best = scratch + bytes;
+	uint8_t best_filter = 0;
+	uint64_t best_cost = UINT64_MAX;
+	for(uint8_t f = 0; f < filters; f++) {
+		apply_filter(candidate, f, row, prev, bytes);
+		uint64_t cost = 0;
+		for(size_t i = 0; i < bytes; i++) cost += (uint8_t)abs((int8_t)candidate[i]);
+		if(cost < best_cost) {
+			uint8_t* swap = best;
+			best = candidate;
+			candidate = swap;
+			best_filter = f;
+			best_cost = cost;
+		}
+	}
+	
+	out[0] = best_filter;
+	memcpy(out + 1, best, bytes);
+}
+
+// --- Deflate ---
+
+#define WINDOW_SIZE 32768
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+#define HASH_BITS 15
+#define HASH_SIZE (1 << HASH_BITS)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define BLOCK_SYMBOLS 32768
+#define MAX_BITS 15
+
+// A literal when dist is 0
+struct deflate_symbol {
+	uint16_t value;
+	uint16_t dist;
+};
+
+struct bit_writer {
+	struct png_buffer* out;
+	uint64_t bits;
+	uint32_t count;
+};
+
+static inline void put_bits(struct bit_writer* w, uint32_t value, uint32_t count) {
+	w->bits |= (uint64_t)value << w->count;
+	w->count += count;
+	if(w->count >= 32) {
+		buffer_reserve(w->out, 4);
+		for(int i = 0; i < 4; i++) w->out->data[w->out->len++] = (uint8_t)(w->bits >> (8 * i));
+		w->bits >>= 32;
+		w->count -= 32;
+	}
+}
+
+static void align_bits(struct bit_writer* w) {
+	buffer_reserve(w->out, 8);
+	while(w->count > 0) {
+		w->out->data[w->out->len++] = (uint8_t)w->bits;
+		w->bits >>= 8;
+		w->count = w->count > 8 ? w->count - 8 : 0;
+	}
+	w->bits = 0;
+}
+
+static int compare_symbol_frequency(const void* a, const void* b) {
+	const uint32_t* x = a;
+	const uint32_t* y = b;
+	if(x[0] != y[0]) return x[0] < y[0] ? -1 : 1;
+	return x[1] < y[1] ? -1 : 1;
+}
+
+// Huffman code lengths no longer than max_bits, always at least two codes so decoders see a complete code
+static void huffman_lengths(const uint32_t* freqs, uint32_t count, uint32_t max_bits, uint8_t* lengths) {
+	uint32_t sorted[288][2]; // frequency, symbol
+	uint32_t n = 0;
+	memset(lengths, 0, count);
+	for(uint32_t s = 0; s < count; s++) {
+		if(freqs[s]) {
+			sorted[n][0] = freqs[s];
+			sorted[n][1] = s;
+			n++;
+		}
+	}
+	if(n < 2) {
+		uint32_t used = n ? sorted[0][1] : 0;
+		lengths[used] = 1;
+		lengths[used ? 0 : 1] = 1;
+		return;
+	}
+	qsort(sorted, n, sizeof(sorted[0]), compare_symbol_frequency);
+	
+	// Two queue construction: leaves in frequency order, internal nodes in creation order
+	uint32_t weights[576], parents[576], depth[576];
+	for(uint32_t i = 0; i < n; i++) weights[i] = sorted[i][0];
+	uint32_t leaf = 0, internal = n, next = n;
+	for(; next < 2*n - 1; next++) {
+		uint32_t pair[2];
+		for(int k = 0; k < 2; k++) {
+			if(leaf < n && (internal >= next || weights[leaf] <= weights[internal])) pair[k] = leaf++;
+			else pair[k] = internal++;
+		}
+		weights[next] = weights[pair[0]] + weights[pair[1]];
+		parents[pair[0]] = parents[pair[1]] = next;
+	}
+	depth[2*n - 2] = 0;
+	for(int32_t i = 2*n - 3; i >= 0; i--) depth[i] = depth[parents[i]] + 1;
+	
+	// Clamp overlong codes, then lengthen shorter ones until the code is complete again
+	uint32_t lengths_count[32] = {0};
+	for(uint32_t i = 0; i < n; i++) lengths_count[depth[i] < max_bits ? depth[i] : max_bits]++;
+	uint32_t total = 0;
+	for(uint32_t b = 1; b <= max_bits; b++) total += lengths_count[b] << (max_bits - b);
+	while(total > (1u << max_bits)) {
+		lengths_count[max_bits]--;
+		for(uint32_t b = max_bits - 1; b > 0; b--) {
+			if(lengths_count[b]) {
+				lengths_count[b]--;
+				lengths_count[b+1] += 2;
+				break;
+			}
+		}
+		total--;
+	}
+	
+	// The rarest symbols get the longest codes
+	uint32_t i = 0;
+	for(uint32_t b = max_bits; b > 0; b--) {
+		for(uint32_t k = 0; k < lengths_count[b]; k++) lengths[sorted[i++][1]] = b;
+	}
+}
+
+static void huffman_codes(struct huffman* h, uint32_t count) {
+	uint32_t lengths_count[MAX_BITS + 1] = {0};
+	for(uint32_t s = 0; s < count; s++) lengths_count[h->lengths[s]]++;
+	lengths_count[0] = 0;
+	
+	uint32_t next_code[MAX_BITS + 1];
+	uint32_t code = 0;
+	for(uint32_t b = 1; b <= MAX_BITS; b++) {
+		code = (code + lengths_count[b-1]) << 1;
+		next_code[b] = code;
+	}
+	
+	for(uint32_t s = 0; s < count; s++) {
+		uint32_t len = h->lengths[s];
+		if(!len) continue;
+		uint32_t c = next_code[len]++, reversed = 0;
+		for(uint32_t b = 0; b < len; b++) reversed |= ((c >> b) & 1) << (len - 1 - b);
+		h->codes[s] = reversed;
+	}
+}
+
+struct deflate_state {
+	uint32_t* head; // hash -> position+1 of its latest occurrence
+	uint32_t* prev; // position & WINDOW_MASK -> position+1 of the previous occurrence with the same hash
+	struct deflate_symbol* symbols;
+	uint32_t symbols_len;
+	size_t block_start; // input offset the pending symbols begin at
+	
+	const struct compression_level* level;
+	const uint8_t* in;
+	size_t in_len;
+	struct bit_writer writer;
+};
+
+static inline uint32_t hash3(const uint8_t* p) {
+	return ((uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2]) * 2654435761u >> (32 - HASH_BITS);
+}
+
+static inline void insert_position(struct deflate_state* s, size_t pos) {
+	if(pos + MIN_MATCH > s->in_len) return;
+	uint32_t h = hash3(s->in + pos);
+	s->prev[pos & WINDOW_MASK] = s->head[h];
+	s->head[h] = (uint32_t)pos + 1;
+}
+
+static inline uint32_t match_length(const uint8_t* a, const uint8_t* b, uint32_t limit) {
+	uint32_t len = 0;
+	while(len + 8 <= limit) {
+		uint64_t x, y;
+		memcpy(&x, a + len, 8);
+		memcpy(&y, b + len, 8);
+		if(x != y) return len + (__builtin_ctzll(x ^ y) >> 3); // little endian
+		len += 8;
+	}
+	while(len < limit && a[len] == b[len]) len++;
+	return len;
+}
+
+// Longest earlier match for pos that beats `best`, 0 when there is none
+static uint32_t find_match(struct deflate_state* s, size_t pos, uint32_t best, uint32_t* distance) {
+	size_t limit = s->in_len - pos < MAX_MATCH ? s->in_len - pos : MAX_MATCH;
+	if(best < MIN_MATCH - 1) best = MIN_MATCH - 1;
+	if(best >= limit) return 0;
+	
+	const uint8_t* p = s->in + pos;
+	uint32_t found = 0;
+	uint32_t candidate = s->head[hash3(p)];
+	for(uint32_t chain = s->level->max_chain; candidate && chain; chain--) {
+		size_t c = candidate - 1;
+		if(pos - c > WINDOW_SIZE) break;
+		
+		const uint8_t* q = s->in + c;
+		if(q[best] == p[best] && q[0] == p[0]) {
+			uint32_t len = match_length(p, q, limit);
+			if(len > best) {
+				best = found = len;
+				*distance = pos - c;
+				if(len >= s->level->nice_length || len == limit) break;
+			}
+		}
+		candidate = s->prev[c & WINDOW_MASK];
+	}
+	return found;
+}
+
+static void write_huffman_header(struct bit_writer* w, const struct huffman* litlen, uint32_t hlit, const struct huffman* dist, uint32_t hdist);
+
+// Writes the pending symbols as whichever of a dynamic, fixed or stored block is smallest
+static void write_block(struct deflate_state* s, size_t block_end, bool final) {
+	uint32_t litlen_freqs[286] = {0}, dist_freqs[30] = {0};
+	uint64_t extra_bits = 0;
+	for(uint32_t i = 0; i < s->symbols_len; i++) {
+		struct deflate_symbol sym = s->symbols[i];
+		if(!sym.dist) {
+			litlen_freqs[sym.value]++;
+			continue;
+		}
+		uint8_t lc = length_codes[sym.value], dc = sym.dist <= 256 ? distance_codes[sym.dist-1] : distance_codes[256 + ((sym.dist-1) >> 7)];
+		litlen_freqs[257 + lc]++;
+		dist_freqs[dc]++;
+		extra_bits += length_extra[lc] + distance_extra[dc];
+	}
+	litlen_freqs[256] = 1;
+	
+	struct huffman litlen, dist;
+	huffman_lengths(litlen_freqs, 286, MAX_BITS, litlen.lengths);
+	huffman_lengths(dist_freqs, 30, MAX_BITS, dist.lengths);
+	huffman_codes(&litlen, 286);
+	huffman_codes(&dist, 30);
+	uint32_t hlit = 286, hdist = 30;
+	while(hlit > 257 && !litlen.lengths[hlit-1]) hlit--;
+	while(hdist > 1 && !dist.lengths[hdist-1]) hdist--;
+	
+	// Measure the dynamic header by writing it to a scratch buffer
+	struct png_buffer header = {0};
+	struct bit_writer header_writer = {.out = &header};
+	write_huffman_header(&header_writer, &litlen, hlit, &dist, hdist);
+	uint64_t dynamic_bits = 3 + header.len * 8 + header_writer.count + extra_bits;
+	uint64_t fixed_bits = 3 + extra_bits;
+	for(uint32_t i = 0; i < 286; i++) {
+		dynamic_bits += (uint64_t)litlen_freqs[i] * litlen.lengths[i];
+		fixed_bits += (uint64_t)litlen_freqs[i] * fixed_litlen.lengths[i];
+	}
+	for(uint32_t i = 0; i < 30; i++) {
+		dynamic_bits += (uint64_t)dist_freqs[i] * dist.lengths[i];
+		fixed_bits += (uint64_t)dist_freqs[i] * fixed_dist.lengths[i];
+	}
+	size_t raw_len = block_end - s->block_start;
+	uint64_t stored_bits = raw_len * 8 + (raw_len / 65535 + 1) * (3 + 7 + 32);
+	
+	struct bit_writer* w = &s->writer;
+	if(stored_bits < dynamic_bits && stored_bits < fixed_bits) {
+		const uint8_t* raw = s->in + s->block_start;
+		do {
+			uint16_t len = raw_len < 65535 ? (uint16_t)raw_len : 65535;
+			put_bits(w, final && len == raw_len ? 1 : 0, 3);
+			align_bits(w);
+			uint8_t lens[4] = {len, len >> 8, ~len, (uint16_t)~len >> 8};
+			buffer_push(w->out, lens, 4);
+			buffer_push(w->out, raw, len);
+			raw += len;
+			raw_len -= len;
+		} while(raw_len);
+	} else {
+		const struct huffman* l = &fixed_litlen;
+		const struct huffman* d = &fixed_dist;
+		if(dynamic_bits < fixed_bits) {
+			put_bits(w, final | 2 << 1, 3);
+			write_huffman_header(w, &litlen, hlit, &dist, hdist);
+			l = &litlen;
+			d = &dist;
+		} else {
+			put_bits(w, final | 1 << 1, 3);
+		}
+		
+		for(uint32_t i = 0; i < s->symbols_len; i++) {
+			struct deflate_symbol sym = s->symbols[i];
+			if(!sym.dist) {
+				put_bits(w, l->codes[sym.value], l->lengths[sym.value]);
+				continue;
+			}
+			uint8_t lc = length_codes[sym.value], dc = sym.dist <= 256 ? distance_codes[sym.dist-1] : distance_codes[256 + ((sym.dist-1) >> 7)];
+			put_bits(w, l->codes[257 + lc], l->lengths[257 + lc]);
+			put_bits(w, sym.value - length_base[lc], length_extra[lc]);
+			put_bits(w, d->codes[dc], d->lengths[dc]);
+			put_bits(w, sym.dist - distance_base[dc], distance_extra[dc]);
+		}
+		put_bits(w, l->codes[256], l->lengths[256]);
+	}
+	
+	png_buffer_destroy(&header);
+	s->symbols_len = 0;
+	s->block_start = block_end;
+}
+
+static void write_huffman_header(struct bit_writer* w, const struct huffman* litlen, uint32_t hlit, const struct huffman* dist, uint32_t hdist) {
+	uint8_t lengths[286 + 30];
+	memcpy(lengths, litlen->lengths, hlit);
+	memcpy(lengths + hlit, dist->lengths, hdist);
+	uint32_t count = hlit + hdist;
+	
+	// Run length encode with 16 (repeat previous), 17 and 18 (repeat zero)
+	uint8_t rle[286 + 30], rle_extra[286 + 30];
+	uint32_t rle_len = 0;
+	uint32_t freqs[19] = {0};
+	for(uint32_t i = 0; i < count;) {
+		uint8_t len = lengths[i];
+		uint32_t run = 1;
+		while(i + run < count && lengths[i + run] == len) run++;
+		i += run;
+		
+		if(!len) {
+			while(run >= 11) {
+				uint32_t r = run < 138 ? run : 138;
+				rle[rle_len] = 18; rle_extra[rle_len++] = r - 11;
+				run -= r;
+			}
+			if(run >= 3) {
+				rle[rle_len] = 17; rle_extra[rle_len++] = run - 3;
+				run = 0;
+			}
+		} else {
+			rle[rle_len] = len; rle_extra[rle_len++] = 0;
+			run--;
+			while(run >= 3) {
+				uint32_t r = run < 6 ? run : 6;
+				rle[rle_len] = 16; rle_extra[rle_len++] = r - 3;
+				run -= r;
+			}
+		}
+		for(; run; run--) {
+			rle[rle_len] = len; rle_extra[rle_len++] = 0;
+		}
+	}
+	for(uint32_t i = 0; i < rle_len; i++) freqs[rle[i]]++;
+	
+	struct huffman codes;
+	huffman_lengths(freqs, 19, 7, codes.lengths);
+	huffman_codes(&codes, 19);
+	uint32_t hclen = 19;
+	while(hclen > 4 && !codes.lengths[code_length_order[hclen-1]]) hclen--;
+	
+	put_bits(w, hlit - 257, 5);
+	put_bits(w, hdist - 1, 5);
+	put_bits(w, hclen - 4, 4);
+	for(uint32_t i = 0; i < hclen; i++) put_bits(w, codes.lengths[code_length_order[i]], 3);
+	for(uint32_t i = 0; i < rle_len; i++) {
+		put_bits(w, codes.codes[rle[i]], codes.lengths[rle[i]]);
+		if(rle[i] == 16) put_bits(w, rle_extra[i], 2);
+		else if(rle[i] == 17) put_bits(w, rle_extra[i], 3);
+		else if(rle[i] == 18) put_bits(w, rle_extra[i], 7);
+	}
+}
+
+static inline void push_symbol(struct deflate_state* s, uint16_t value, uint16_t dist, size_t next_pos) {
+	s->symbols[s->symbols_len++] = (struct deflate_symbol){value, dist};
+	if(s->symbols_len == BLOCK_SYMBOLS) write_block(s, next_pos, false);
+}
+
+// Deflates in[start, end) as raw deflate blocks, matching back into in[0, start) as a preset window.
+// Non-final chunks end with an empty stored block so the next chunk starts on a byte boundary.
+static void deflate_chunk(struct deflate_state* s, const uint8_t* in, size_t start, size_t end, bool final, struct png_buffer* out) {
+	s->in = in;
+	s->in_len = end;
+	s->symbols_len = 0;
+	s->block_start = start;
+	s->writer = (struct bit_writer){.out = out};
+	memset(s->head, 0, sizeof(uint32_t) * HASH_SIZE);
+	for(size_t pos = start > WINDOW_SIZE ? start - WINDOW_SIZE : 0; pos < start; pos++) insert_position(s, pos);
+	
+	const struct compression_level* level = s->level;
+	bool pending = false; // the byte before pos is not emitted yet, pending_len/dist being its match
+	uint32_t pending_len = 0, pending_dist = 0;
+	size_t pos = start;
+	while(pos < end) {
+		uint32_t dist = 0;
+		uint32_t match = pending && pending_len >= level->nice_length ? 0 : find_match(s, pos, pending ? pending_len : 0, &dist);
+		insert_position(s, pos);
+		
+		if(pending && pending_len >= MIN_MATCH && pending_len >= match) {
+			size_t match_end = pos - 1 + pending_len;
+			for(size_t p = pos + 1; p < match_end; p++) insert_position(s, p);
+			push_symbol(s, pending_len, pending_dist, match_end);
+			pos = match_end;
+			pending = false;
+			continue;
+		}
+		if(pending) push_symbol(s, in[pos-1], 0, pos);
+		
+		if(level->lazy) {
+			pending = true;
+			pending_len = match;
+			pending_dist = dist;
+			pos++;
+		} else if(match >= MIN_MATCH) {
+			size_t match_end = pos + match;
+			if(match <= level->nice_length) for(size_t p = pos + 1; p < match_end; p++) insert_position(s, p); // skipping long runs keeps fast fast
+			push_symbol(s, match, dist, match_end);
+			pos = match_end;
+		} else {
+			push_symbol(s, in[pos], 0, pos + 1);
+			pos++;
+		}
+	}
+	if(pending) push_symbol(s, in[pos-1], 0, pos);
+	
+	if(s->symbols_len || final) write_block(s, end, final);
+	if(!final) {
+		put_bits(&s->writer, 0, 3);
+		align_bits(&s->writer);
+		buffer_push(out, (uint8_t[]){0x00, 0x00, 0xFF, 0xFF}, 4);
+	}
+	align_bits(&s->writer);
+}
+
+// --- Chunked encoding ---
+
+struct png_chunk {
+	struct png_buffer deflated;
+	uint32_t adler;
+	size_t filtered_len;
+};
+
+// A batch of consecutive chunks deflated together, the rows they and their windows need being resident
+struct png_job {
+	const uint8_t* pixels; // image row pixels_first
+	ptrdiff_t stride;
+	uint32_t pixels_first;
+	uint32_t width;
+	uint32_t height;
+	const struct compression_level* level;
+	uint32_t rows_per_chunk;
+	uint32_t window_rows; // rows before a chunk filtered again to prime its window
+	uint32_t total_chunks;
+	
+	uint32_t first_chunk;
+	uint32_t chunks_len;
+	struct png_chunk* chunks;
+	uint32_t adler; // of every chunk written so far
+	
+	pthread_mutex_t lock;
+	uint32_t next_chunk;
+};
+
+static void png_job_init(struct png_job* job, uint32_t width, uint32_t height, enum png_compression compression) {
+	assert(width && height);
+	pthread_once(&tables_once, init_tables);
+	
+	const size_t filtered_row = (size_t)width * 4 + 1;
+	*job = (struct png_job){
+		.width = width,
+		.height = height,
+		.level = &levels[compression],
+		.adler = 1
+	};
+	job->rows_per_chunk = job->level->chunk_bytes / filtered_row ? job->level->chunk_bytes / filtered_row : 1;
+	job->window_rows = (WINDOW_SIZE + filtered_row - 1) / filtered_row;
+	job->total_chunks = (height + job->rows_per_chunk - 1) / job->rows_per_chunk;
+}
+
+// First image row the chunk's filtering reads, its window plus the row above
+static uint32_t chunk_rows_first(const struct png_job* job, uint32_t chunk) {
+	uint32_t first = chunk * job->rows_per_chunk;
+	return first > job->window_rows + 1 ? first - job->window_rows - 1 : 0;
+}
+
+static void* png_worker(void* arg) {
+	struct png_job* job = arg;
+	const size_t row_bytes = (size_t)job->width * 4;
+	const size_t filtered_row = row_bytes + 1;
+	
+	struct deflate_state state = {.level = job->level};
+	state.head = malloc(sizeof(uint32_t) * HASH_SIZE);
+	state.prev = malloc(sizeof(uint32_t) * WINDOW_SIZE);
+	state.symbols = malloc(sizeof(struct deflate_symbol) * BLOCK_SYMBOLS);
+	uint8_t* filtered = malloc(filtered_row * (job->rows_per_chunk + job->window_rows));
+	uint8_t* zero_row = calloc(1, row_bytes);
+	uint8_t* scratch = malloc(row_bytes * 2);
+	assert(state.head && state.prev && state.symbols && filtered && zero_row && scratch);
+	
+	for(;;) {
+		pthread_mutex_lock(&job->lock);
+		uint32_t i = job->next_chunk;
+		if(i < job->chunks_len) job->next_chunk++;
+		pthread_mutex_unlock(&job->lock);
+		if(i >= job->chunks_len) break;
+		
+		uint32_t c = job->first_chunk + i;
+		uint32_t first = c * job->rows_per_chunk;
+		uint32_t last = first + job->rows_per_chunk < job->height ? first + job->rows_per_chunk : job->height;
+		uint32_t window_first = first > job->window_rows ? first - job->window_rows : 0;
+		for(uint32_t y = window_first; y < last; y++) {
+			const uint8_t* row = job->pixels + job->stride * (ptrdiff_t)(y - job->pixels_first);
+			filter_row(filtered + filtered_row * (y - window_first), row, y ? row - job->stride : zero_row, row_bytes, job->level->filters, scratch);
+		}
+		
+		struct png_chunk* chunk = &job->chunks[i];
+		size_t start = filtered_row * (first - window_first);
+		chunk->filtered_len = filtered_row * (last - first);
+		chunk->adler = adler32_update(1, filtered + start, chunk->filtered_len);
+		deflate_chunk(&state, filtered, start, start + chunk->filtered_len, c == job->total_chunks - 1, &chunk->deflated);
+	}
+	
+	free(scratch);
+	free(zero_row);
+	free(filtered);
+	free(state.symbols);
+	free(state.prev);
+	free(state.head);
+	return NULL;
+}
+
+// Writes a chunk's length and type, returning where its checksum starts
+static size_t begin_png_chunk(struct png_buffer* out, const char* type, size_t len) {
+	buffer_push_u32(out, (uint32_t)len);
+	size_t crc_start = out->len;
+	buffer_push(out, type, 4);
+	return crc_start;
+}
+
+static void end_png_chunk(struct png_buffer* out, size_t crc_start) {
+	buffer_push_u32(out, crc32_update(0, out->data + crc_start, out->len - crc_start));
+}
+
+static void push_png_header(struct png_buffer* out, uint32_t width, uint32_t height) {
+	static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	buffer_push(out, signature, 8);
+	uint8_t header[13] = {
+		width >> 24, width >> 16, width >> 8, width,
+		height >> 24, height >> 16, height >> 8, height,
+		8, 6, 0, 0, 0 // 8 bit RGBA, deflate, adaptive filtering, not interlaced
+	};
+	size_t crc_start = begin_png_chunk(out, "IHDR", 13);
+	buffer_push(out, header, 13);
+	end_png_chunk(out, crc_start);
+}
+
+// Deflates the job's batch of chunks on up to `threads` threads and appends them as IDATs,
+// the first chunk of the image carrying the zlib header and the last its checksum
+static void push_png_chunks(struct png_buffer* out, struct png_job* job, uint32_t threads) {
+	if(threads > job->chunks_len) threads = job->chunks_len;
+	job->next_chunk = 0;
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_t* workers = malloc(sizeof(pthread_t) * threads);
+	assert(workers);
+	uint32_t started = 0;
+	for(; started+1 < threads; started++) {
+		if(pthread_create(&workers[started], NULL, png_worker, job) != 0) break;
+	}
+	png_worker(job);
+	for(uint32_t t = 0; t < started; t++) pthread_join(workers[t], NULL);
+	free(workers);
+	pthread_mutex_destroy(&job->lock);
+	
+	for(uint32_t i = 0; i < job->chunks_len; i++) {
+		struct png_chunk* chunk = &job->chunks[i];
+		job->adler = adler32_combine(job->adler, chunk->adler, chunk->filtered_len);
+		
+		bool first = job->first_chunk + i == 0, last = job->first_chunk + i == job->total_chunks - 1;
+		size_t crc_start = begin_png_chunk(out, "IDAT", chunk->deflated.len + (first ? 2 : 0) + (last ? 4 : 0));
+		if(first) buffer_push(out, (uint8_t[]){0x78, job->level->zlib_flags}, 2);
+		buffer_push(out, chunk->deflated.data, chunk->deflated.len);
+		if(last) buffer_push_u32(out, job->adler);
+		end_png_chunk(out, crc_start);
+		png_buffer_destroy(&chunk->deflated);
+	}
+}
+
+static uint32_t thread_count(uint32_t threads) {
+	if(threads) return threads;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores > 0 ? (uint32_t)cores : 1;
+}
+
+void png_encode(struct png_buffer* out, const uint8_t* pixels, uint32_t width, uint32_t height, ptrdiff_t stride, enum png_compression compression, uint32_t threads) {
+	struct png_job job;
+	png_job_init(&job, width, height, compression);
+	job.pixels = pixels;
+	job.stride = stride;
+	job.chunks_len = job.total_chunks;
+	job.chunks = calloc(job.chunks_len, sizeof(struct png_chunk));
+	assert(job.chunks);
+	
+	push_png_header(out, width, height);
+	push_png_chunks(out, &job, thread_count(threads));
+	end_png_chunk(out, begin_png_chunk(out, "IEND", 0));
+	free(job.chunks);
+}
+
+// --- Streaming ---
+
+struct png_stream {
+	struct png_buffer* out;
+	struct png_job job;
+	uint32_t threads;
+	uint32_t batch_chunks;
+	
+	uint8_t* rows; // buffered image rows from rows_first, top-down
+	uint32_t rows_first;
+	uint32_t rows_len;
+};
+
+struct png_stream* png_stream_begin(struct png_buffer* out, uint32_t width, uint32_t height, enum png_compression compression, uint32_t threads) {
+	struct png_stream* s = calloc(1, sizeof(struct png_stream));
+	assert(s);
+	s->out = out;
+	png_job_init(&s->job, width, height, compression);
+	s->threads = thread_count(threads);
+	s->batch_chunks = s->threads; // one chunk per thread at a time
+	
+	s->job.chunks = calloc(s->batch_chunks, sizeof(struct png_chunk));
+	s->rows = malloc((size_t)width * 4 * (s->batch_chunks * s->job.rows_per_chunk + s->job.window_rows + 1));
+	assert(s->job.chunks && s->rows);
+	
+	push_png_header(out, width, height);
+	return s;
+}
+
+void png_stream_rows(struct png_stream* s, const uint8_t* rows, uint32_t count, ptrdiff_t stride) {
+	struct png_job* job = &s->job;
+	const size_t row_bytes = (size_t)job->width * 4;
+	for(uint32_t r = 0; r < count; r++) {
+		assert(s->rows_first + s->rows_len < job->height);
+		memcpy(s->rows + row_bytes * s->rows_len++, rows + stride * (ptrdiff_t)r, row_bytes);
+		
+		uint32_t chunks_end = job->first_chunk + s->batch_chunks < job->total_chunks ? job->first_chunk + s->batch_chunks : job->total_chunks;
+		uint32_t batch_end = chunks_end * job->rows_per_chunk < job->height ? chunks_end * job->rows_per_chunk : job->height;
+		if(s->rows_first + s->rows_len < batch_end) continue;
+		
+		job->pixels = s->rows;
+		job->stride = row_bytes;
+		job->pixels_first = s->rows_first;
+		job->chunks_len = chunks_end - job->first_chunk;
+		push_png_chunks(s->out, job, s->threads);
+		job->first_chunk = chunks_end;
+		
+		// Keep the rows the next batch's first window reaches back to
+		uint32_t keep = chunk_rows_first(job, chunks_end);
+		if(keep < s->rows_first) keep = s->rows_first;
+		if(keep > batch_end) keep = batch_end; // after the last batch
+		s->rows_len -= keep - s->rows_first;
+		memmove(s->rows, s->rows + row_bytes * (keep - s->rows_first), row_bytes * s->rows_len);
+		s->rows_first = keep;
+	}
+}
+
+bool png_stream_end(struct png_stream* s) {
+	bool complete = s->job.first_chunk == s->job.total_chunks;
+	if(complete) end_png_chunk(s->out, begin_png_chunk(s->out, "IEND", 0));
+	free(s->rows);
+	free(s->job.chunks);
+	free(s);
+	return complete;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Effort spent on filtering and deflating, the default is balanced
+enum png_compression {
+	PNG_COMPRESSION_BALANCED,
+	PNG_COMPRESSION_FAST,
+	PNG_COMPRESSION_SMALLEST
+};
+
+struct png_buffer {
+	uint8_t* data;
+	size_t len;
+	size_t cap;
+};
+
+void png_buffer_destroy(struct png_buffer* buf);
+
+// Appends an RGBA8 PNG to `out`. Rows are `stride` bytes apart, negative to store a bottom-up image top-down.
+// The image is deflated in independent chunks of rows on up to `threads` threads (0 uses every core);
+// the output is the same whatever the thread count.
+void png_encode(struct png_buffer* out, const uint8_t* pixels, uint32_t width, uint32_t height, ptrdiff_t stride, enum png_compression compression, uint32_t threads);
+
+// Writes a PNG a few rows at a time, keeping one chunk of rows per thread resident whatever the height.
+// Encoded bytes are appended to `out` as they are ready, for the caller to drain between calls.
+// The output matches png_encode.
+struct png_stream;
+
+struct png_stream* png_stream_begin(struct png_buffer* out, uint32_t width, uint32_t height, enum png_compression compression, uint32_t threads);
+void png_stream_rows(struct png_stream* s, const uint8_t* rows, uint32_t count, ptrdiff_t stride); // rows are given top-down
+bool png_stream_end(struct png_stream* s); // frees the stream, false if the image was left incomplete
@@ -4,57 +4,168 @@
 #include <string.h>
 #include <assert.h>
 
+// Slab elements start after the header, padded to keep them 16-byte aligned
+#define SLAB_HEADER_SIZE ((sizeof(struct pool_slab) + 15) & ~(size_t)15)
+
 struct pool* pool_init(size_t poolSize, size_t poolCount) {
 	assert(poolSize);
 	assert(poolCount);
 	assert(poolSize % 16 == 0); // ensure 16-byte alignment amongst elements
-	assert(poolCount % 16 == 0); // ensure 16-byte alignment after the pool struct and inUse array
+	assert(poolSize >= sizeof(void*)); // freed elements hold the free list link
 	
-	void* a = malloc(sizeof(struct pool) + sizeof(bool)*poolCount + poolSize*poolCount);
-	struct pool* p = (struct pool*)a;
+	struct pool* p = calloc(1, sizeof(struct pool));
+	assert(p);
 	p->poolSize = poolSize;
 	p->poolCount = poolCount;
-	p->poolsUsed = 0;
-	p->pools = a + sizeof(struct pool) + sizeof(bool)*poolCount;
-	memset(p->inUse, 0, sizeof(bool)*poolCount);
-	
 	return p;
 }
 
+static struct pool_slab* slab_create(struct pool* p) {
+	struct pool_slab* slab = malloc(SLAB_HEADER_SIZE + p->poolSize*p->poolCount);
+	assert(slab);
+	slab->next = NULL;
+	p->slabCount++;
+	return slab;
+}
+
 void* pool_alloc(struct pool* p) {
 	assert(p);
 	
-	void* data = NULL;
-	
-	// TODO: Optimize the search to start where left off last time
-	for(size_t i = 0; i < p->poolCount; i++) {
-		if(!p->inUse[i]) {
-			data = p->pools + (i * p->poolSize);
-			p->inUse[i] = true;
-			break;
+	void* data;
+	if(p->freeList) {
+		data = p->freeList;
+		p->freeList = *(void**)data;
+	} else {
+		// Carve the next element from the current slab, moving on to the next one when it is full
+		if(!p->slab) {
+			if(!p->slabs) p->slabs = slab_create(p);
+			p->slab = p->slabs;
+			p->slabUsed = 0;
+		} else if(p->slabUsed == p->poolCount) {
+			if(!p->slab->next) p->slab->next = slab_create(p);
+			p->slab = p->slab->next;
+			p->slabUsed = 0;
 		}
+		data = (char*)p->slab + SLAB_HEADER_SIZE + p->slabUsed*p->poolSize;
+		p->slabUsed++;
 	}
 	
-	assert(data);
 	p->poolsUsed++;
+	if(p->poolsUsed > p->poolsHighWater) p->poolsHighWater = p->poolsUsed;
 	
 	return data;
 }
 
 void pool_free(struct pool* p, void* data) {
 	assert(p);
-	assert(data >= p->pools && data < p->pools + (p->poolSize*p->poolCount));
-	size_t idx = (data - p->pools) / p->poolSize;
-	p->inUse[idx] = false;
+	assert(data);
+	assert(p->poolsUsed);
+	*(void**)data = p->freeList;
+	p->freeList = data;
 	p->poolsUsed--;
 }
 
+// Releases every element at once, keeping the slabs for reuse
 void pool_reset(struct pool* p) {
 	assert(p);
-	memset(p->inUse, 0, p->poolCount);
+	p->slab = NULL;
+	p->slabUsed = 0;
+	p->freeList = NULL;
 	p->poolsUsed = 0;
 }
 
 void pool_destroy(struct pool* p) {
+	if(!p) return;
+	for(struct pool_slab* slab = p->slabs; slab;) {
+		struct pool_slab* next = slab->next;
+		free(slab);
+		slab = next;
+	}
 	free(p);
-}
\ No newline at end of file
+}
+
+struct pool_stats pool_get_stats(const struct pool* p) {
+	assert(p);
+	return (struct pool_stats){
+		.used = p->poolsUsed,
+		.highWater = p->poolsHighWater,
+		.slabs = p->slabCount,
+		.bytesReserved = p->slabCount * (SLAB_HEADER_SIZE + p->poolSize*p->poolCount),
+	};
+}
+
+struct pool_classes* pool_classes_init(size_t minSize, size_t maxSize, size_t slabBytes) {
+	assert(minSize);
+	assert(minSize <= maxSize);
+	
+	struct pool_classes* pc = calloc(1, sizeof(struct pool_classes));
+	assert(pc);
+	for(size_t size = minSize; size <= maxSize; size *= 2) {
+		assert(pc->classesLen < POOL_MAX_CLASSES);
+		size_t count = slabBytes / size;
+		pc->classes[pc->classesLen++] = pool_init(size, count ? count : 1);
+	}
+	return pc;
+}
+
+// Smallest class holding the size, or NULL when none does
+static struct pool* pool_class(const struct pool_classes* pc, size_t size) {
+	for(size_t i = 0; i < pc->classesLen; i++) {
+		if(size <= pc->classes[i]->poolSize) return pc->classes[i];
+	}
+	return NULL;
+}
+
+// Allocates at least size bytes, reporting the usable capacity to pass back when freeing
+void* pool_classes_alloc(struct pool_classes* pc, size_t size, size_t* capacity) {
+	assert(pc);
+	assert(capacity);
+	
+	struct pool* p = pool_class(pc, size);
+	if(!p) {
+		*capacity = size;
+		void* data = malloc(size);
+		assert(data);
+		return data;
+	}
+	*capacity = p->poolSize;
+	return pool_alloc(p);
+}
+
+void pool_classes_free(struct pool_classes* pc, void* data, size_t capacity) {
+	assert(pc);
+	if(!data) return;
+	
+	struct pool* p = pool_class(pc, capacity);
+	if(p) {
+		assert(p->poolSize == capacity);
+		pool_free(p, data);
+	} else {
+		free(data);
+	}
+}
+
+void pool_classes_reset(struct pool_classes* pc) {
+	assert(pc);
+	for(size_t i = 0; i < pc->classesLen; i++) pool_reset(pc->classes[i]);
+}
+
+void pool_classes_destroy(struct pool_classes* pc) {
+	if(!pc) return;
+	for(size_t i = 0; i < pc->classesLen; i++) pool_destroy(pc->classes[i]);
+	free(pc);
+}
+
+// Totals over every class, the high-water mark is the sum of each class's
+struct pool_stats pool_classes_get_stats(const struct pool_classes* pc) {
+	assert(pc);
+	struct pool_stats stats = {0};
+	for(size_t i = 0; i < pc->classesLen; i++) {
+		struct pool_stats class_stats = pool_get_stats(pc->classes[i]);
+		stats.used += class_stats.used;
+		stats.highWater += class_stats.highWater;
+		stats.slabs += class_stats.slabs;
+		stats.bytesReserved += class_stats.bytesReserved;
+	}
+	return stats;
+}
@@ -3,12 +3,30 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+// Fixed-size element allocator. Freed elements are chained through their own storage,
+// and the pool grows by chaining slabs of poolCount elements.
+struct pool_slab {
+	struct pool_slab* next;
+};
+
+struct pool_stats {
+	size_t used;
+	size_t highWater;
+	size_t slabs;
+	size_t bytesReserved;
+};
+
 struct pool {
 	size_t poolSize;
-	size_t poolCount;
+	size_t poolCount; // elements per slab
 	size_t poolsUsed;
-	void* pools;
-	bool inUse[];
+	size_t poolsHighWater;
+	size_t slabCount;
+	
+	struct pool_slab* slabs; // oldest first
+	struct pool_slab* slab; // slab being carved
+	size_t slabUsed; // elements carved from it
+	void* freeList;
 };
 
 struct pool* pool_init(size_t poolSize, size_t poolCount);
@@ -16,3 +34,20 @@ void* pool_alloc(struct pool* p);
 void pool_free(struct pool* p, void* data);
 void pool_reset(struct pool* p);
 void pool_destroy(struct pool* p);
+struct pool_stats pool_get_stats(const struct pool* p);
+
+// Pools of doubling element sizes, for variable-size blocks.
+// Requests above the largest class go to malloc.
+#define POOL_MAX_CLASSES 16
+
+struct pool_classes {
+	size_t classesLen;
+	struct pool* classes[POOL_MAX_CLASSES];
+};
+
+struct pool_classes* pool_classes_init(size_t minSize, size_t maxSize, size_t slabBytes);
+void* pool_classes_alloc(struct pool_classes* pc, size_t size, size_t* capacity);
+void pool_classes_free(struct pool_classes* pc, void* data, size_t capacity);
+void pool_classes_reset(struct pool_classes* pc);
+void pool_classes_destroy(struct pool_classes* pc);
+struct pool_stats pool_classes_get_stats(const struct pool_classes* pc);
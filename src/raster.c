@@ -0,0 +1,234 @@
+#include "raster.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void raster_texture_init(struct raster_texture* tex, const uint8_t* pixels, uint32_t width, uint32_t height) {
+	assert(tex && pixels);
+	tex->width = width;
+	tex->height = height;
+	tex->stride = width + 2;
+	tex->texels = calloc(tex->stride * (height + 2), 1);
+	assert(tex->texels);
+	for(uint32_t y = 0; y < height; y++) {
+		memcpy(&tex->texels[(y+1) * tex->stride + 1], &pixels[y * width], width);
+	}
+}
+
+void raster_texture_destroy(struct raster_texture* tex) {
+	assert(tex);
+	free(tex->texels);
+	*tex = (struct raster_texture){0};
+}
+
+void raster_clear(struct raster_image* image) {
+	assert(image);
+	memset(image->pixels, 0, (size_t)image->width * image->height * 4);
+}
+
+// Everything constant across one stamp's pixels
+struct stamp_shading {
+	const struct raster_texture* brush;
+	const struct raster_texture* mask;
+	colorf color;
+	float transparency; // 1 - alpha, subtracted from the coverage
+};
+
+// Bilinear filter of one texture at texture coordinates known to lie in [0, 1)
+static inline float sample_linear(const struct raster_texture* tex, float u, float v) {
+	float sx = u * tex->width - 0.5f;
+	float sy = v * tex->height - 0.5f;
+	int32_t x0 = (int32_t)(sx + 1.0f) - 1; // floor, sx >= -0.5
+	int32_t y0 = (int32_t)(sy + 1.0f) - 1;
+	float fx = sx - x0;
+	float fy = sy - y0;
+	
+	const uint8_t* row = &tex->texels[(y0+1) * tex->stride + (x0+1)];
+	float t00 = row[0], t10 = row[1];
+	float t01 = row[tex->stride], t11 = row[tex->stride + 1];
+	float top = t00 + (t10 - t00) * fx;
+	float bottom = t01 + (t11 - t01) * fx;
+	return (top + (bottom - top) * fy) * (1.0f / 255.0f);
+}
+
+static inline uint32_t unorm8(float value) {
+	if(value < 0.0f) value = 0.0f;
+	else if(value > 1.0f) value = 1.0f;
+	return (uint32_t)lrintf(value * 255.0f);
+}
+
+static inline uint32_t div255(uint32_t x) {
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+static inline void shade_pixel(uint8_t* dst, float u, float v, const struct stamp_shading* sh) {
+	float intensity = 1.0f - sample_linear(sh->brush, u, v);
+	float mask = sample_linear(sh->mask, u, v);
+	
+	uint32_t a = unorm8((mask < intensity ? mask : intensity) - sh->transparency);
+	if(!a) return;
+	uint32_t src[4] = {
+		unorm8(sh->color.r * intensity),
+		unorm8(sh->color.g * intensity),
+		unorm8(sh->color.b * intensity),
+		a
+	};
+	for(int c = 0; c < 4; c++) dst[c] = div255(src[c] * a + dst[c] * (255 - a));
+}
+
+#ifdef __SSE2__
+static inline __m128 floor_nonneg_ps(__m128 x, __m128i* xi) {
+	// Truncation floors anything above -1, lanes outside the stamp are masked off by the caller
+	*xi = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(x, _mm_set1_ps(1.0f))), _mm_set1_epi32(1));
+	return _mm_cvtepi32_ps(*xi);
+}
+
+static inline __m128 sample_linear4(const struct raster_texture* tex, __m128 u, __m128 v, __m128i inside) {
+	__m128 sx = _mm_sub_ps(_mm_mul_ps(u, _mm_set1_ps((float)tex->width)), _mm_set1_ps(0.5f));
+	__m128 sy = _mm_sub_ps(_mm_mul_ps(v, _mm_set1_ps((float)tex->height)), _mm_set1_ps(0.5f));
+	__m128i x0, y0;
+	__m128 fx = _mm_sub_ps(sx, floor_nonneg_ps(sx, &x0));
+	__m128 fy = _mm_sub_ps(sy, floor_nonneg_ps(sy, &y0));
+	
+	// Texels are gathered one lane at a time, lanes outside the stamp read the zero border
+	int32_t xs[4], ys[4], in[4];
+	_mm_storeu_si128((__m128i*)xs, x0);
+	_mm_storeu_si128((__m128i*)ys, y0);
+	_mm_storeu_si128((__m128i*)in, inside);
+	float t00[4], t10[4], t01[4], t11[4];
+	for(int k = 0; k < 4; k++) {
+		const uint8_t* row = in[k] ? &tex->texels[(ys[k]+1) * tex->stride + (xs[k]+1)] : tex->texels;
+		t00[k] = row[0];
+		t10[k] = row[1];
+		t01[k] = row[tex->stride];
+		t11[k] = row[tex->stride + 1];
+	}
+	
+	__m128 a = _mm_loadu_ps(t00), b = _mm_loadu_ps(t10);
+	__m128 c = _mm_loadu_ps(t01), d = _mm_loadu_ps(t11);
+	__m128 top = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), fx));
+	__m128 bottom = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(d, c), fx));
+	return _mm_mul_ps(_mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), fy)), _mm_set1_ps(1.0f / 255.0f));
+}
+
+static inline __m128i unorm8_4(__m128 value) {
+	value = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	return _mm_cvtps_epi32(_mm_mul_ps(value, _mm_set1_ps(255.0f)));
+}
+
+static inline __m128i div255_epu16(__m128i x) {
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// Shades four neighbouring pixels, matching shade_pixel lane for lane
+static inline void shade_pixels4(uint8_t* dst, __m128 u, __m128 v, const struct stamp_shading* sh) {
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+	__m128i inside = _mm_castps_si128(_mm_and_ps(
+		_mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmplt_ps(u, one)),
+		_mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmplt_ps(v, one))));
+	if(!_mm_movemask_epi8(inside)) return;
+	
+	__m128 intensity = _mm_sub_ps(one, sample_linear4(sh->brush, u, v, inside));
+	__m128 mask = sample_linear4(sh->mask, u, v, inside);
+	
+	__m128i a = _mm_and_si128(unorm8_4(_mm_sub_ps(_mm_min_ps(mask, intensity), _mm_set1_ps(sh->transparency))), inside);
+	if(!_mm_movemask_epi8(_mm_cmpgt_epi32(a, _mm_setzero_si128()))) return;
+	__m128i r = unorm8_4(_mm_mul_ps(_mm_set1_ps(sh->color.r), intensity));
+	__m128i g = unorm8_4(_mm_mul_ps(_mm_set1_ps(sh->color.g), intensity));
+	__m128i b = unorm8_4(_mm_mul_ps(_mm_set1_ps(sh->color.b), intensity));
+	__m128i src = _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(b, 16), _mm_slli_epi32(a, 24)));
+	
+	// Per-channel alpha, widened to 16 bits for src*a + dst*(255-a)
+	__m128i a16 = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+	__m128i alpha_lo = _mm_unpacklo_epi32(a16, a16);
+	__m128i alpha_hi = _mm_unpackhi_epi32(a16, a16);
+	const __m128i zero16 = _mm_setzero_si128(), full = _mm_set1_epi16(255);
+	
+	__m128i pixels = _mm_loadu_si128((const __m128i*)dst);
+	__m128i lo = _mm_add_epi16(
+		_mm_mullo_epi16(_mm_unpacklo_epi8(src, zero16), alpha_lo),
+		_mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero16), _mm_sub_epi16(full, alpha_lo)));
+	__m128i hi = _mm_add_epi16(
+		_mm_mullo_epi16(_mm_unpackhi_epi8(src, zero16), alpha_hi),
+		_mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero16), _mm_sub_epi16(full, alpha_hi)));
+	_mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(div255_epu16(lo), div255_epu16(hi)));
+}
+#endif
+
+static void raster_stamp(struct raster_image* image, const struct raster_view* view, const struct lb_stroke_stamp* stamp, const struct stamp_shading* sh) {
+	if(stamp->scale <= 0.0f) return;
+	
+	// Window-space bounds of the rotated quad, covering pixel centers only
+	double c = cos(stamp->rotation), s = sin(stamp->rotation);
+	double extent = 0.5 * stamp->scale * (fabs(c) + fabs(s));
+	double x_a = (stamp->translation.x - extent - view->origin.x) * view->scale.x;
+	double x_b = (stamp->translation.x + extent - view->origin.x) * view->scale.x;
+	double y_a = (stamp->translation.y - extent - view->origin.y) * view->scale.y;
+	double y_b = (stamp->translation.y + extent - view->origin.y) * view->scale.y;
+	int64_t x_begin = (int64_t)ceil(fmin(x_a, x_b) - 0.5), x_end = (int64_t)floor(fmax(x_a, x_b) - 0.5) + 1;
+	int64_t y_begin = (int64_t)ceil(fmin(y_a, y_b) - 0.5), y_end = (int64_t)floor(fmax(y_a, y_b) - 0.5) + 1;
+	if(x_begin < 0) x_begin = 0;
+	if(y_begin < 0) y_begin = 0;
+	if(x_end > image->width) x_end = image->width;
+	if(y_end > image->height) y_end = image->height;
+	if(x_begin >= x_end || y_begin >= y_end) return;
+	
+	// The inverse of brush.vert's transform: texture coordinates are affine in window coordinates
+	double k = 1.0 / stamp->scale;
+	double dx = view->origin.x - stamp->translation.x;
+	double dy = view->origin.y - stamp->translation.y;
+	double u_x = c * k / view->scale.x, u_y = s * k / view->scale.y;
+	double v_x = s * k / view->scale.x, v_y = -c * k / view->scale.y;
+	double u_0 = 0.5 + (dx * c + dy * s) * k;
+	double v_0 = 0.5 - (-dx * s + dy * c) * k;
+	
+	for(int64_t y = y_begin; y < y_end; y++) {
+		double yw = y + 0.5;
+		float u_row = (float)(u_0 + u_y * yw + u_x * 0.5);
+		float v_row = (float)(v_0 + v_y * yw + v_x * 0.5);
+		float u_step = (float)u_x, v_step = (float)v_x;
+		uint8_t* row = &image->pixels[((size_t)y * image->width) * 4];
+		
+		int64_t x = x_begin;
+		#ifdef __SSE2__
+		const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+		for(; x + 4 <= x_end; x += 4) {
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+			__m128 u = _mm_add_ps(_mm_set1_ps(u_row), _mm_mul_ps(px, _mm_set1_ps(u_step)));
+			__m128 v = _mm_add_ps(_mm_set1_ps(v_row), _mm_mul_ps(px, _mm_set1_ps(v_step)));
+			shade_pixels4(&row[x * 4], u, v, sh);
+		}
+		#endif
+		for(; x < x_end; x++) {
+			float u = u_row + (float)x * u_step;
+			float v = v_row + (float)x * v_step;
+			if(u < 0.0f || u >= 1.0f || v < 0.0f || v >= 1.0f) continue;
+			shade_pixel(&row[x * 4], u, v, sh);
+		}
+	}
+}
+
+void raster_stamps(struct raster_image* image, const struct raster_view* view,
+	const struct raster_texture* brush, const struct raster_texture* mask,
+	const struct lb_stroke_stamp* stamps, uint32_t count, bool reverse,
+	colorf color, float alpha) {
+	assert(image && view && brush && mask);
+	
+	const struct stamp_shading sh = {
+		.brush = brush,
+		.mask = mask,
+		.color = color,
+		.transparency = 1.0f - alpha
+	};
+	for(uint32_t p = 0; p < count; p++) {
+		raster_stamp(image, view, &stamps[reverse ? count-1 - p : p], &sh);
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "util.h"
+#include "strokes.h"
+
+// Single channel texture sampled like GL_LINEAR with GL_CLAMP_TO_BORDER,
+// rows bottom-up as uploaded to GL, kept with a border of zero texels
+struct raster_texture {
+	uint8_t* texels;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride; // width + 2
+};
+
+// RGBA8 target, rows bottom-up like glReadPixels
+struct raster_image {
+	uint8_t* pixels;
+	uint32_t width;
+	uint32_t height;
+};
+
+// Maps world coordinates to window coordinates: window = (world - origin) * scale
+struct raster_view {
+	vec2 origin;
+	vec2 scale;
+};
+
+void raster_texture_init(struct raster_texture* tex, const uint8_t* pixels, uint32_t width, uint32_t height);
+void raster_texture_destroy(struct raster_texture* tex);
+
+void raster_clear(struct raster_image* image);
+
+// Stamps the brush like brush.vert/brush.frag with SRC_ALPHA, ONE_MINUS_SRC_ALPHA blending,
+// back to front when reversed
+void raster_stamps(struct raster_image* image, const struct raster_view* view,
+	const struct raster_texture* brush, const struct raster_texture* mask,
+	const struct lb_stroke_stamp* stamps, uint32_t count, bool reverse,
+	colorf color, float alpha);
@@ -0,0 +1,270 @@
+#include "spatial.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#define SPATIAL_INITIAL_CAPACITY 256
+#define SPATIAL_COORD_LIMIT (1 << 20) // cells either side of the origin; anything further shares the edge cells
+#define SPATIAL_LARGE_CELLS 4096 // boxes covering more cells than this go in the large list instead
+
+struct cell_range {
+	int32_t x0, y0, x1, y1;
+};
+
+static uint32_t hash_id(uint64_t id) {
+	return (uint32_t)(id ^ id >> 32) * 2654435761u;
+}
+
+static uint32_t hash_cell(int32_t x, int32_t y) {
+	return (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u;
+}
+
+// Clamped so far away or NaN coordinates still land in a cell and stay in range of int32_t
+static int32_t cell_coord(const struct spatial_grid* g, float v) {
+	float c = floorf(v / g->cell_size);
+	if(!(c > -SPATIAL_COORD_LIMIT)) return -SPATIAL_COORD_LIMIT;
+	if(c > SPATIAL_COORD_LIMIT) return SPATIAL_COORD_LIMIT;
+	return (int32_t)c;
+}
+
+static struct cell_range cell_range(const struct spatial_grid* g, vec2 min, vec2 max) {
+	return (struct cell_range){cell_coord(g, min.x), cell_coord(g, min.y), cell_coord(g, max.x), cell_coord(g, max.y)};
+}
+
+static uint64_t range_cells(struct cell_range r) {
+	if(r.x1 < r.x0 || r.y1 < r.y0) return 0;
+	return (uint64_t)(r.x1 - r.x0 + 1) * (uint64_t)(r.y1 - r.y0 + 1);
+}
+
+// Slot holding the id, or the empty slot where it would go
+static struct spatial_item* find_item(struct spatial_grid* g, uint64_t id) {
+	size_t mask = g->items_cap - 1;
+	for(size_t i = hash_id(id) & mask;; i = (i + 1) & mask) {
+		struct spatial_item* item = &g->items[i];
+		if(!item->used || item->id == id) return item;
+	}
+}
+
+static struct spatial_cell* find_cell(struct spatial_grid* g, int32_t x, int32_t y) {
+	size_t mask = g->cells_cap - 1;
+	for(size_t i = hash_cell(x, y) & mask;; i = (i + 1) & mask) {
+		struct spatial_cell* cell = &g->cells[i];
+		if(!cell->used || (cell->x == x && cell->y == y)) return cell;
+	}
+}
+
+// Capacity to rehash a full table into: the same when most of it was removed, otherwise double
+static size_t rehash_cap(size_t cap, size_t live) {
+	return (live + 1) * 4 > cap ? cap * 2 : cap;
+}
+
+static void grow_items(struct spatial_grid* g) {
+	struct spatial_item* old = g->items;
+	size_t old_cap = g->items_cap;
+	
+	// Removed items are dropped while rehashing
+	size_t live = 0;
+	for(size_t i = 0; i < old_cap; i++) live += old[i].live;
+	g->items_cap = rehash_cap(old_cap, live);
+	g->items = calloc(g->items_cap, sizeof(struct spatial_item));
+	assert(g->items);
+	g->items_used = 0;
+	for(size_t i = 0; i < old_cap; i++) {
+		if(!old[i].live) continue;
+		*find_item(g, old[i].id) = old[i];
+		g->items_used++;
+	}
+	free(old);
+}
+
+static void grow_cells(struct spatial_grid* g) {
+	struct spatial_cell* old = g->cells;
+	size_t old_cap = g->cells_cap;
+	
+	// Emptied cells are dropped while rehashing
+	size_t live = 0;
+	for(size_t i = 0; i < old_cap; i++) live += old[i].live;
+	g->cells_cap = rehash_cap(old_cap, live);
+	g->cells = calloc(g->cells_cap, sizeof(struct spatial_cell));
+	assert(g->cells);
+	g->cells_used = 0;
+	for(size_t i = 0; i < old_cap; i++) {
+		if(!old[i].live) continue;
+		*find_cell(g, old[i].x, old[i].y) = old[i];
+		g->cells_used++;
+	}
+	free(old);
+}
+
+static void cell_add(struct spatial_grid* g, int32_t x, int32_t y, uint64_t id) {
+	if((g->cells_used + 1) * 2 > g->cells_cap) grow_cells(g);
+	
+	struct spatial_cell* cell = find_cell(g, x, y);
+	if(!cell->used) g->cells_used++;
+	if(!cell->live) *cell = (struct spatial_cell){.x = x, .y = y, .used = true, .live = true};
+	if(cell->len == cell->cap) {
+		cell->cap = cell->cap ? cell->cap * 2 : 8;
+		cell->ids = realloc(cell->ids, sizeof(uint64_t) * cell->cap);
+		assert(cell->ids);
+	}
+	cell->ids[cell->len++] = id;
+}
+
+static void cell_remove(struct spatial_grid* g, int32_t x, int32_t y, uint64_t id) {
+	struct spatial_cell* cell = find_cell(g, x, y);
+	assert(cell->live);
+	for(uint32_t i = 0; i < cell->len; i++) {
+		if(cell->ids[i] == id) {
+			cell->ids[i] = cell->ids[--cell->len]; // swap
+			if(!cell->len) {
+				// Cells a dragged handle passed through would otherwise pile up over a session
+				free(cell->ids);
+				cell->ids = NULL;
+				cell->cap = 0;
+				cell->live = false;
+			}
+			return;
+		}
+	}
+	assert(false);
+}
+
+static void large_add(struct spatial_grid* g, uint64_t id) {
+	if(g->large_len == g->large_cap) {
+		g->large_cap = g->large_cap ? g->large_cap * 2 : 8;
+		g->large = realloc(g->large, sizeof(uint64_t) * g->large_cap);
+		assert(g->large);
+	}
+	g->large[g->large_len++] = id;
+}
+
+static void large_remove(struct spatial_grid* g, uint64_t id) {
+	for(size_t i = 0; i < g->large_len; i++) {
+		if(g->large[i] == id) {
+			g->large[i] = g->large[--g->large_len]; // swap
+			return;
+		}
+	}
+	assert(false);
+}
+
+struct spatial_grid* spatial_init(float cell_size) {
+	assert(cell_size > 0);
+	
+	struct spatial_grid* g = calloc(1, sizeof(struct spatial_grid));
+	assert(g);
+	g->cell_size = cell_size;
+	g->items_cap = SPATIAL_INITIAL_CAPACITY;
+	g->items = calloc(g->items_cap, sizeof(struct spatial_item));
+	g->cells_cap = SPATIAL_INITIAL_CAPACITY;
+	g->cells = calloc(g->cells_cap, sizeof(struct spatial_cell));
+	assert(g->items && g->cells);
+	return g;
+}
+
+// Inserts the box, or moves it when the id is already present
+void spatial_update(struct spatial_grid* g, uint64_t id, vec2 min, vec2 max) {
+	assert(g);
+	spatial_remove(g, id);
+	
+	if((g->items_used + 1) * 2 > g->items_cap) grow_items(g);
+	struct spatial_item* item = find_item(g, id);
+	if(!item->used) g->items_used++;
+	struct cell_range r = cell_range(g, min, max);
+	bool large = range_cells(r) > SPATIAL_LARGE_CELLS;
+	*item = (struct spatial_item){.id = id, .min = min, .max = max, .used = true, .live = true, .large = large};
+	
+	if(large) {
+		large_add(g, id);
+		return;
+	}
+	for(int32_t y = r.y0; y <= r.y1; y++) {
+		for(int32_t x = r.x0; x <= r.x1; x++) {
+			cell_add(g, x, y, id);
+		}
+	}
+}
+
+void spatial_remove(struct spatial_grid* g, uint64_t id) {
+	assert(g);
+	struct spatial_item* item = find_item(g, id);
+	if(!item->live) return;
+	item->live = false;
+	
+	if(item->large) {
+		large_remove(g, id);
+		return;
+	}
+	struct cell_range r = cell_range(g, item->min, item->max);
+	for(int32_t y = r.y0; y <= r.y1; y++) {
+		for(int32_t x = r.x0; x <= r.x1; x++) {
+			cell_remove(g, x, y, id);
+		}
+	}
+}
+
+// Adds the id to the query's results if its box overlaps and it was not reported already
+static void query_visit(struct spatial_grid* g, uint64_t id, vec2 min, vec2 max, size_t* len) {
+	struct spatial_item* item = find_item(g, id);
+	if(item->mark == g->mark) return;
+	item->mark = g->mark;
+	if(item->max.x < min.x || item->min.x > max.x || item->max.y < min.y || item->min.y > max.y) return;
+	
+	if(*len == g->results_cap) {
+		g->results_cap = g->results_cap ? g->results_cap * 2 : 64;
+		g->results = realloc(g->results, sizeof(uint64_t) * g->results_cap);
+		assert(g->results);
+	}
+	g->results[(*len)++] = item->id;
+}
+
+// Ids of every box overlapping the query box, each reported once.
+// The returned array is owned by the grid and valid until the next query.
+const uint64_t* spatial_query(struct spatial_grid* g, vec2 min, vec2 max, size_t* len) {
+	assert(g);
+	assert(len);
+	*len = 0;
+	g->mark++;
+	
+	struct cell_range r = cell_range(g, min, max);
+	if(range_cells(r) > g->cells_cap) {
+		// Fewer slots than cells in the box, so the table is walked instead
+		for(size_t c = 0; c < g->cells_cap; c++) {
+			struct spatial_cell* cell = &g->cells[c];
+			if(!cell->live || cell->x < r.x0 || cell->x > r.x1 || cell->y < r.y0 || cell->y > r.y1) continue;
+			for(uint32_t i = 0; i < cell->len; i++) query_visit(g, cell->ids[i], min, max, len);
+		}
+	} else {
+		for(int32_t y = r.y0; y <= r.y1; y++) {
+			for(int32_t x = r.x0; x <= r.x1; x++) {
+				struct spatial_cell* cell = find_cell(g, x, y);
+				if(!cell->live) continue;
+				for(uint32_t i = 0; i < cell->len; i++) query_visit(g, cell->ids[i], min, max, len);
+			}
+		}
+	}
+	for(size_t i = 0; i < g->large_len; i++) query_visit(g, g->large[i], min, max, len);
+	return g->results;
+}
+
+void spatial_reset(struct spatial_grid* g) {
+	assert(g);
+	for(size_t i = 0; i < g->cells_cap; i++) free(g->cells[i].ids);
+	memset(g->cells, 0, sizeof(struct spatial_cell) * g->cells_cap);
+	memset(g->items, 0, sizeof(struct spatial_item) * g->items_cap);
+	g->cells_used = 0;
+	g->items_used = 0;
+	g->large_len = 0;
+}
+
+void spatial_destroy(struct spatial_grid* g) {
+	if(!g) return;
+	for(size_t i = 0; i < g->cells_cap; i++) free(g->cells[i].ids);
+	free(g->cells);
+	free(g->items);
+	free(g->results);
+	free(g->large);
+	free(g);
+}
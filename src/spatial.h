@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "util.h"
+
+// Uniform hash grid of axis-aligned boxes, addressed by caller-chosen ids
+struct spatial_item {
+	uint64_t id;
+	uint32_t mark; // last query that reported this item
+	vec2 min;
+	vec2 max;
+	bool used;
+	bool live; // false for removed items still occupying their probe slot
+	bool large; // kept in the grid's large list rather than in cells
+};
+
+struct spatial_cell {
+	int32_t x, y;
+	uint64_t* ids;
+	uint32_t len, cap;
+	bool used;
+	bool live; // false once emptied, keeping its probe slot until the cells are rehashed
+};
+
+struct spatial_grid {
+	float cell_size;
+	
+	struct spatial_item* items;
+	size_t items_cap;
+	size_t items_used;
+	
+	struct spatial_cell* cells;
+	size_t cells_cap;
+	size_t cells_used;
+	
+	uint64_t* large; // ids of boxes covering too many cells to index, checked by every query
+	size_t large_len;
+	size_t large_cap;
+	
+	uint32_t mark;
+	uint64_t* results;
+	size_t results_cap;
+};
+
+struct spatial_grid* spatial_init(float cell_size);
+void spatial_update(struct spatial_grid* g, uint64_t id, vec2 min, vec2 max);
+void spatial_remove(struct spatial_grid* g, uint64_t id);
+const uint64_t* spatial_query(struct spatial_grid* g, vec2 min, vec2 max, size_t* len);
+void spatial_reset(struct spatial_grid* g);
+void spatial_destroy(struct spatial_grid* g);
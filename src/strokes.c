@@ -8,77 +8,457 @@
 #include <math.h>
 #include <libgen.h>
 #include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "gl.h"
 #include "util.h"
 #include "pool.h"
+#include "spatial.h"
+#include "sweep.h"
+#include "raster.h"
+#include "encoder.h"
+#include "gif.h"
+#include "atlas.h"
 
 #include <GLFW/glfw3.h>
 
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include <stb_image_write.h>
-
 //TODO: Reduce footprint by removing image formats
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
 #define RANDOM_SAMPLE_SIZE 1024
-static float random_samples[RANDOM_SAMPLE_SIZE];
 
-#define MAX_STROKES 64
-#define MAX_STROKE_VERTICES 64
+#define SEGMENTS_INDEX_CELL_SIZE 64.0f
+#define STAMPS_POOL_MIN_STAMPS 64
+#define STAMPS_POOL_MAX_STAMPS (64 * 256)
+#define STAMPS_POOL_SLAB_BYTES (256 * 1024)
+
+// What the curve shader's buffers hold for a stroke, kept at the slots of its vertex range
+struct stroke_curves {
+	bool uploaded;
+	bool records_valid; // false once control points move, even when the arc lengths do not change
+	uint32_t vertices_moves; // data.vertices_moves when uploaded, any range may have moved since it differs
+	uint16_t tables_begin; // segments [begin, end) whose arc-length tables changed since
+	uint16_t tables_end;
+	float scale; // stamp spacing the records were laid out for
+	uint32_t stamps_len;
+	float length;
+};
+
+// Per-stroke fields read by the render loop, kept apart from the editable records
+struct stroke_hot {
+	float begin; // lifetime [begin, end), refreshed with the timeline index
+	float end;
+	uint32_t vertices_first; // range of the packed vertex storage owned by the stroke
+	uint32_t vertices_cap;
+	uint16_t vertices_len; // bounded by the .line format's u16 count
+	struct lb_stroke_stamps stamps; // along with the stroke's cached arc length
+	struct stroke_curves curves;
+};
 
 static struct {
-	struct pool* vertices_pool;
-	struct lb_stroke strokes[MAX_STROKES];
+	struct lb_stroke* strokes; // editable records, parallel to hot
+	struct stroke_hot* hot;
 	uint32_t strokes_len;
+	uint32_t strokes_cap;
+	
+	// Every stroke's vertices packed in ranges, with the arc-length table of the segment starting at each one
+	struct bezier_point* vertices;
+	struct bezier_distance_cache* distances;
+	uint32_t vertices_len; // slots handed out, holes included
+	uint32_t vertices_cap;
+	uint32_t vertices_holes; // slots left behind by moved or deleted ranges
+	uint32_t vertices_moves; // bumped whenever ranges move to other slots
+	
+	struct pool_classes* stamps_pool; // stamp lists, rebuilt often while editing
+	struct spatial_grid* segments_index;
+	struct interval_sweep timeline; // stroke lifetimes, ids are stroke indices
+	bool timeline_dirty;
 } data;
 
+static float random_samples[RANDOM_SAMPLE_SIZE];
+
+struct lb_stroke* lb_strokes_selected = NULL;
+struct bezier_point* lb_strokes_selected_vertex = NULL;
+static struct lb_stroke* hovered_stroke = NULL;
+static vec2* drag_vec = NULL;
+
+static struct stroke_hot* stroke_hot(const struct lb_stroke* stroke) {
+	assert(stroke);
+	size_t idx = stroke - data.strokes;
+	assert(idx < data.strokes_len);
+	return &data.hot[idx];
+}
+
+static struct bezier_point* stroke_vertices(const struct lb_stroke* stroke) {
+	return &data.vertices[stroke_hot(stroke)->vertices_first];
+}
+
+static struct bezier_distance_cache* stroke_distances(const struct lb_stroke* stroke) {
+	return &data.distances[stroke_hot(stroke)->vertices_first];
+}
+
+// Moves the editor's pointers into a vertex range along with it
+static void rebase_vertex_pointers(const struct bezier_point* from, uint32_t len, struct bezier_point* to) {
+	if(lb_strokes_selected_vertex >= from && lb_strokes_selected_vertex < from + len) {
+		lb_strokes_selected_vertex = to + (lb_strokes_selected_vertex - from);
+	}
+	if((void*)drag_vec >= (void*)from && (void*)drag_vec < (void*)(from + len)) {
+		drag_vec = (vec2*)((char*)to + ((char*)drag_vec - (char*)from));
+	}
+}
+
+static void reserve_strokes(uint32_t count) {
+	if(data.strokes_len + count <= data.strokes_cap) return;
+	
+	uint32_t cap = data.strokes_cap ? data.strokes_cap * 2 : 64;
+	if(cap < data.strokes_len + count) cap = data.strokes_len + count;
+	
+	struct lb_stroke* strokes = malloc(sizeof(struct lb_stroke) * cap);
+	struct stroke_hot* hot = malloc(sizeof(struct stroke_hot) * cap);
+	assert(strokes && hot);
+	if(data.strokes_len) {
+		memcpy(strokes, data.strokes, sizeof(struct lb_stroke) * data.strokes_len);
+		memcpy(hot, data.hot, sizeof(struct stroke_hot) * data.strokes_len);
+	}
+	
+	if(lb_strokes_selected) lb_strokes_selected = strokes + (lb_strokes_selected - data.strokes);
+	if(hovered_stroke) hovered_stroke = strokes + (hovered_stroke - data.strokes);
+	
+	free(data.strokes);
+	free(data.hot);
+	data.strokes = strokes;
+	data.hot = hot;
+	data.strokes_cap = cap;
+}
+
+static void reserve_vertices(uint32_t count) {
+	if(data.vertices_len + count <= data.vertices_cap) return;
+	
+	uint32_t cap = data.vertices_cap ? data.vertices_cap * 2 : 256;
+	if(cap < data.vertices_len + count) cap = data.vertices_len + count;
+	
+	struct bezier_point* vertices = malloc(sizeof(struct bezier_point) * cap);
+	struct bezier_distance_cache* distances = malloc(sizeof(struct bezier_distance_cache) * cap);
+	assert(vertices && distances);
+	if(data.vertices_len) {
+		memcpy(vertices, data.vertices, sizeof(struct bezier_point) * data.vertices_len);
+		memcpy(distances, data.distances, sizeof(struct bezier_distance_cache) * data.vertices_len);
+	}
+	rebase_vertex_pointers(data.vertices, data.vertices_len, vertices);
+	
+	free(data.vertices);
+	free(data.distances);
+	data.vertices = vertices;
+	data.distances = distances;
+	data.vertices_cap = cap;
+}
+
+// Packs the ranges back together once the holes outweigh the slots in use
+static void compact_vertices() {
+	if(data.vertices_holes * 2 <= data.vertices_len) return;
+	
+	struct bezier_point* vertices = malloc(sizeof(struct bezier_point) * data.vertices_cap);
+	struct bezier_distance_cache* distances = malloc(sizeof(struct bezier_distance_cache) * data.vertices_cap);
+	assert(vertices && distances);
+	
+	uint32_t len = 0;
+	for(size_t i = 0; i < data.strokes_len; i++) {
+		struct stroke_hot* hot = &data.hot[i];
+		memcpy(&vertices[len], &data.vertices[hot->vertices_first], sizeof(struct bezier_point) * hot->vertices_len);
+		memcpy(&distances[len], &data.distances[hot->vertices_first], sizeof(struct bezier_distance_cache) * hot->vertices_len);
+		rebase_vertex_pointers(&data.vertices[hot->vertices_first], hot->vertices_len, &vertices[len]);
+		hot->vertices_first = len;
+		len += hot->vertices_cap;
+	}
+	
+	free(data.vertices);
+	free(data.distances);
+	data.vertices = vertices;
+	data.distances = distances;
+	data.vertices_len = len;
+	data.vertices_holes = 0;
+	data.vertices_moves++;
+}
+
+// Makes room for more vertices in the stroke's range, growing it in place when it ends
+// the storage and moving it to the end otherwise
+static void reserve_stroke_vertices(struct lb_stroke* stroke, uint32_t count) {
+	struct stroke_hot* hot = stroke_hot(stroke);
+	if(hot->vertices_len + count <= hot->vertices_cap) return;
+	
+	uint32_t cap = hot->vertices_cap ? hot->vertices_cap * 2 : 8;
+	if(cap < hot->vertices_len + count) cap = hot->vertices_len + count;
+	
+	if(hot->vertices_first + hot->vertices_cap == data.vertices_len) {
+		reserve_vertices(cap - hot->vertices_cap);
+		data.vertices_len += cap - hot->vertices_cap;
+	} else {
+		reserve_vertices(cap);
+		uint32_t first = data.vertices_len;
+		data.vertices_len += cap;
+		memcpy(&data.vertices[first], &data.vertices[hot->vertices_first], sizeof(struct bezier_point) * hot->vertices_len);
+		memcpy(&data.distances[first], &data.distances[hot->vertices_first], sizeof(struct bezier_distance_cache) * hot->vertices_len);
+		rebase_vertex_pointers(&data.vertices[hot->vertices_first], hot->vertices_len, &data.vertices[first]);
+		data.vertices_holes += hot->vertices_cap;
+		hot->vertices_first = first;
+		data.vertices_moves++;
+	}
+	hot->vertices_cap = cap;
+	
+	compact_vertices();
+}
+
+// Widens the range of segments whose arc-length tables the curve shader has out of date
+static void invalidate_curves(struct stroke_hot* hot, uint16_t begin, uint16_t end) {
+	struct stroke_curves* curves = &hot->curves;
+	curves->records_valid = false;
+	if(curves->tables_begin >= curves->tables_end) {
+		curves->tables_begin = begin;
+		curves->tables_end = end;
+		return;
+	}
+	if(begin < curves->tables_begin) curves->tables_begin = begin;
+	if(end > curves->tables_end) curves->tables_end = end;
+}
+
+// Marks the arc-length tables of every segment touching the vertex as stale
+static void invalidate_vertex(struct lb_stroke* stroke, const struct bezier_point* vertex) {
+	struct stroke_hot* hot = stroke_hot(stroke);
+	struct bezier_distance_cache* distances = stroke_distances(stroke);
+	size_t idx = vertex - stroke_vertices(stroke);
+	assert(idx < hot->vertices_len);
+	if(idx > 0) distances[idx-1].valid = false;
+	distances[idx].valid = false;
+	hot->stamps.valid = false;
+	invalidate_curves(hot, idx > 0 ? idx-1 : 0, idx+1);
+}
+
+static void invalidate_stroke(struct lb_stroke* stroke) {
+	struct stroke_hot* hot = stroke_hot(stroke);
+	struct bezier_distance_cache* distances = stroke_distances(stroke);
+	for(size_t i = 0; i < hot->vertices_len; i++) distances[i].valid = false;
+	hot->stamps.valid = false;
+	invalidate_curves(hot, 0, hot->vertices_len);
+}
+
+// Arc-length table of the segment between vertices [idx] and [idx+1], re-integrated only when stale
+static const struct bezier_distance_cache* segment_distances(struct lb_stroke* stroke, size_t idx) {
+	assert(idx+1 < stroke_hot(stroke)->vertices_len);
+	struct bezier_distance_cache* cache = &stroke_distances(stroke)[idx];
+	if(!cache->valid) {
+		struct bezier_point* a = &stroke_vertices(stroke)[idx];
+		struct bezier_point* b = a + 1;
+		bezier_distance_update_cache(cache, a->anchor, a->handles[1], b->handles[0], b->anchor);
+	}
+	return cache;
+}
+
+static struct {
+	float* t;
+	size_t cap;
+} t_buffer;
+
+static void reserve_stamps(struct lb_stroke_stamps* stamps, uint32_t count) {
+	if(count <= stamps->cap) return;
+	
+	size_t capacity;
+	struct lb_stroke_stamp* grown = pool_classes_alloc(data.stamps_pool, sizeof(struct lb_stroke_stamp) * count * 2, &capacity);
+	if(stamps->len) memcpy(grown, stamps->stamps, sizeof(struct lb_stroke_stamp) * stamps->len);
+	pool_classes_free(data.stamps_pool, stamps->stamps, sizeof(struct lb_stroke_stamp) * stamps->cap);
+	stamps->stamps = grown;
+	stamps->cap = capacity / sizeof(struct lb_stroke_stamp);
+}
+
+static void free_stamps(struct lb_stroke_stamps* stamps) {
+	pool_classes_free(data.stamps_pool, stamps->stamps, sizeof(struct lb_stroke_stamp) * stamps->cap);
+	*stamps = (struct lb_stroke_stamps){0};
+}
+
+// Lays out the brush stamps along the whole stroke, equidistant within each segment
+static void build_stamps(struct lb_stroke* stroke) {
+	struct stroke_hot* hot = stroke_hot(stroke);
+	struct lb_stroke_stamps* stamps = &hot->stamps;
+	stamps->len = 0;
+	stamps->length = 0.0f;
+	stamps->scale = stroke->scale;
+	stamps->jitter = stroke->jitter;
+	stamps->valid = true;
+	
+	for(size_t s = 0; s+1 < hot->vertices_len; s++) {
+		const struct bezier_distance_cache* distances = segment_distances(stroke, s);
+		struct bezier_point* a = &stroke_vertices(stroke)[s];
+		struct bezier_point* b = a + 1;
+		
+		float segment_length = distances->total;
+		if(segment_length <= 0.0f) continue; // coincident points, nothing to stamp
+		
+		uint32_t total_equidistant_points_len = (uint32_t)ceil(segment_length / (stroke->scale / 2.0f));
+		uint32_t points_len = total_equidistant_points_len + 1;
+		
+		reserve_stamps(stamps, stamps->len + points_len);
+		if(points_len > t_buffer.cap) {
+			t_buffer.cap = points_len * 2;
+			t_buffer.t = realloc(t_buffer.t, sizeof(float) * t_buffer.cap);
+			assert(t_buffer.t);
+		}
+		bezier_distance_equidistant_t(distances, total_equidistant_points_len, 0, points_len, t_buffer.t);
+		
+		for(uint32_t p = 0; p < points_len; p++) {
+			struct lb_stroke_stamp* stamp = &stamps->stamps[stamps->len++];
+			stamp->translation = bezier_cubic(a->anchor, a->handles[1], b->handles[0], b->anchor, t_buffer.t[p]);
+			stamp->rotation = (float)p;
+			stamp->length = stamps->length + segment_length * (p / (float)total_equidistant_points_len);
+			
+			stamp->scale = stroke->scale;
+			if(stroke->jitter > 0) {
+				stamp->scale += stamp->scale * map(random_samples[p % RANDOM_SAMPLE_SIZE], 0, 1, -stroke->jitter, stroke->jitter);
+			}
+		}
+		
+		stamps->length += segment_length;
+	}
+}
+
+// Stamps are rebuilt lazily, also picking up thickness and jitter edits made directly on the stroke
+static const struct lb_stroke_stamps* stroke_stamps(struct lb_stroke* stroke) {
+	struct lb_stroke_stamps* stamps = &stroke_hot(stroke)->stamps;
+	if(!stamps->valid || stamps->scale != stroke->scale || stamps->jitter != stroke->jitter) {
+		build_stamps(stroke);
+	}
+	return stamps;
+}
+
+// Index of the first stamp lying beyond the given arc length
+static uint32_t stamps_upper_bound(const struct lb_stroke_stamps* stamps, float length) {
+	uint32_t lo = 0, hi = stamps->len;
+	while(lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if(stamps->stamps[mid].length <= length) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+// Segments are indexed by their stroke's index in the high bits and their own in the low bits
+#define SEGMENT_ID(stroke_idx, segment) ((uint64_t)(stroke_idx) << 32 | (uint64_t)(segment))
+#define SEGMENT_ID_STROKE(id) ((uint32_t)((id) >> 32))
+#define SEGMENT_ID_SEGMENT(id) ((uint32_t)(id))
+
+static void index_segment(const struct lb_stroke* stroke, size_t s) {
+	uint64_t id = SEGMENT_ID(stroke - data.strokes, s);
+	if(s+1 >= stroke_hot(stroke)->vertices_len) {
+		spatial_remove(data.segments_index, id);
+		return;
+	}
+	
+	// The curve lies within its control polygon
+	const struct bezier_point* vertices = stroke_vertices(stroke);
+	vec2 points[4] = {
+		vertices[s].anchor,
+		vertices[s].handles[1],
+		vertices[s+1].handles[0],
+		vertices[s+1].anchor,
+	};
+	vec2 min = points[0], max = points[0];
+	for(size_t i = 1; i < 4; i++) {
+		min.x = fminf(min.x, points[i].x);
+		min.y = fminf(min.y, points[i].y);
+		max.x = fmaxf(max.x, points[i].x);
+		max.y = fmaxf(max.y, points[i].y);
+	}
+	spatial_update(data.segments_index, id, min, max);
+}
+
+// Re-indexes the segments touching the vertex
+static void index_vertex(const struct lb_stroke* stroke, const struct bezier_point* vertex) {
+	size_t idx = vertex - stroke_vertices(stroke);
+	if(idx > 0) index_segment(stroke, idx-1);
+	index_segment(stroke, idx);
+}
+
+static void index_stroke(const struct lb_stroke* stroke) {
+	for(size_t s = 0; s < stroke_hot(stroke)->vertices_len; s++) index_segment(stroke, s);
+}
+
+static void unindex_stroke(const struct lb_stroke* stroke) {
+	for(size_t s = 0; s < stroke_hot(stroke)->vertices_len; s++) spatial_remove(data.segments_index, SEGMENT_ID(stroke - data.strokes, s));
+}
+
 static struct lb_stroke* create_stroke() {
-	assert(data.strokes_len < MAX_STROKES);
+	reserve_strokes(1);
 	
-	struct lb_stroke* stroke = &data.strokes[data.strokes_len++];
-	stroke->vertices = pool_alloc(data.vertices_pool);
-	stroke->vertices_len = 0;
-	return stroke;
+	uint32_t idx = data.strokes_len++;
+	data.hot[idx] = (struct stroke_hot){
+		.vertices_first = data.vertices_len, // empty range at the end, so it grows in place
+	};
+	data.timeline_dirty = true;
+	return &data.strokes[idx];
 }
 
 static void delete_stroke(struct lb_stroke* stroke) {
-	assert(stroke);
+	struct stroke_hot* hot = stroke_hot(stroke);
+	
+	free_stamps(&hot->stamps);
+	unindex_stroke(stroke);
+	if(hot->vertices_first + hot->vertices_cap == data.vertices_len) data.vertices_len -= hot->vertices_cap;
+	else data.vertices_holes += hot->vertices_cap;
+	hovered_stroke = NULL;
+	data.timeline_dirty = true;
 	
-	pool_free(data.vertices_pool, stroke->vertices);
 	size_t idx = stroke - data.strokes;
+	size_t last = data.strokes_len-1;
+	if(idx < last) unindex_stroke(&data.strokes[last]); // its segment ids change with its index
 	data.strokes_len--;
-	if(idx < data.strokes_len) data.strokes[idx] = data.strokes[data.strokes_len]; // swap
+	if(idx < last) {
+		data.strokes[idx] = data.strokes[last]; // swap
+		data.hot[idx] = data.hot[last];
+		index_stroke(&data.strokes[idx]);
+	}
+	
+	compact_vertices();
 }
 
 static struct lb_stroke* duplicate_stroke(const struct lb_stroke* stroke) {
-	assert(stroke);
-	struct lb_stroke* s = create_stroke();
-	void* vertices_pool = s->vertices;
-	memcpy(s, stroke, sizeof(struct lb_stroke));
-	s->vertices = vertices_pool;
-	memcpy(s->vertices, stroke->vertices, sizeof(struct bezier_point)*stroke->vertices_len);
+	size_t idx = stroke - data.strokes;
+	struct lb_stroke* s = create_stroke(); // may move the source
+	*s = data.strokes[idx];
+	
+	uint16_t vertices_len = data.hot[idx].vertices_len;
+	reserve_stroke_vertices(s, vertices_len);
+	struct stroke_hot* hot = stroke_hot(s);
+	hot->vertices_len = vertices_len;
+	memcpy(stroke_vertices(s), &data.vertices[data.hot[idx].vertices_first], sizeof(struct bezier_point)*vertices_len);
+	memcpy(stroke_distances(s), &data.distances[data.hot[idx].vertices_first], sizeof(struct bezier_distance_cache)*vertices_len);
+	index_stroke(s);
 	return s;
 }
 
 static struct bezier_point* add_vertex(struct lb_stroke* stroke) {
-	assert(stroke);
-	return &stroke->vertices[stroke->vertices_len++];
+	struct stroke_hot* hot = stroke_hot(stroke);
+	assert(hot->vertices_len < UINT16_MAX);
+	reserve_stroke_vertices(stroke, 1);
+	struct bezier_point* vertex = &stroke_vertices(stroke)[hot->vertices_len++];
+	invalidate_vertex(stroke, vertex);
+	return vertex;
 }
 
 static void delete_vertex(struct lb_stroke* stroke, struct bezier_point* vertex) {
-	assert(stroke);
-	size_t idx = vertex - stroke->vertices;
-	assert(idx >= 0);
-	assert(idx < MAX_STROKE_VERTICES);
-	stroke->vertices_len--;
-	if(idx < stroke->vertices_len) stroke->vertices[idx] = stroke->vertices[stroke->vertices_len]; // swap
+	struct stroke_hot* hot = stroke_hot(stroke);
+	struct bezier_point* vertices = stroke_vertices(stroke);
+	size_t idx = vertex - vertices;
+	assert(idx < hot->vertices_len);
+	unindex_stroke(stroke);
+	hot->vertices_len--;
+	if(idx < hot->vertices_len) vertices[idx] = vertices[hot->vertices_len]; // swap
+	invalidate_stroke(stroke);
+	index_stroke(stroke);
 }
 
-
 // Timeline
+enum lb_render_mode lb_strokes_render_mode = RENDER_STAMPS;
 color32 lb_clear_color = (color32){.r = 255, .g = 255, .b = 255, .a = 255};
 bool lb_strokes_playing = false;
 float lb_strokes_timelineDuration = 10.0f;
@@ -123,6 +503,39 @@ static struct {
 	GLuint vbo;
 } gl_lines;
 
+static struct {
+	vec2* vertices;
+	size_t len;
+	size_t cap;
+} overlay_buffer;
+
+static void overlay_push(vec2 v) {
+	if(overlay_buffer.len == overlay_buffer.cap) {
+		overlay_buffer.cap = overlay_buffer.cap ? overlay_buffer.cap * 2 : 1024;
+		overlay_buffer.vertices = realloc(overlay_buffer.vertices, sizeof(vec2) * overlay_buffer.cap);
+		assert(overlay_buffer.vertices);
+	}
+	overlay_buffer.vertices[overlay_buffer.len++] = v;
+}
+
+// Line pairs tracing every segment of the stroke
+static void overlay_push_curves(const struct lb_stroke* stroke) {
+	const struct bezier_point* vertices = stroke_vertices(stroke);
+	for(size_t v = 0; v+1 < stroke_hot(stroke)->vertices_len; v++) {
+		const struct bezier_point* a = &vertices[v];
+		const struct bezier_point* b = &vertices[v+1];
+		float len = bezier_estimate_length(a->anchor, a->handles[1], b->handles[0], b->anchor);
+		uint16_t segments = hyperbola_min_segments(len);
+		vec2 prev = a->anchor;
+		for(uint16_t i = 1; i <= segments; i++) {
+			vec2 loc = bezier_cubic(a->anchor, a->handles[1], b->handles[0], b->anchor, i / (float)segments);
+			overlay_push(prev);
+			overlay_push(loc);
+			prev = loc;
+		}
+	}
+}
+
 static struct shaderProgram line_shader;
 #include "../build/assets/shaders/line.frag.c"
 #include "../build/assets/shaders/line.vert.c"
@@ -139,24 +552,50 @@ static struct shaderProgram brush_shader;
 enum brush_shader_uniform {
 	BRUSH_UNIFORM_PROJECTION = 0,
 	BRUSH_UNIFORM_PAN,
-	BRUSH_UNIFORM_TRANSLATION,
-	BRUSH_UNIFORM_SCALE,
-	BRUSH_UNIFORM_ROTATION,
 	BRUSH_UNIFORM_COLOR,
 	BRUSH_UNIFORM_ALPHA,
 	BRUSH_UNIFORM_MASK_TEXTURE,
 	BRUSH_UNIFORM_BRUSH_TEXTURE
 };
 
+static struct shaderProgram brush_curve_shader;
+#include "../build/assets/shaders/brush_curve.vert.c"
+enum brush_curve_shader_uniform {
+	BRUSH_CURVE_UNIFORM_SEGMENTS = BRUSH_UNIFORM_BRUSH_TEXTURE+1, // shares the brush shader's uniforms up to here
+	BRUSH_CURVE_UNIFORM_LENGTHS,
+	BRUSH_CURVE_UNIFORM_RANDOM_SAMPLES,
+	BRUSH_CURVE_UNIFORM_SEGMENTS_FIRST,
+	BRUSH_CURVE_UNIFORM_SEGMENTS_LEN,
+	BRUSH_CURVE_UNIFORM_STAMPS_FIRST,
+	BRUSH_CURVE_UNIFORM_STAMPS_LEN,
+	BRUSH_CURVE_UNIFORM_REVERSE,
+	BRUSH_CURVE_UNIFORM_SCALE,
+	BRUSH_CURVE_UNIFORM_JITTER
+};
+
+static struct shaderProgram ribbon_shader;
+#include "../build/assets/shaders/ribbon.frag.c"
+#include "../build/assets/shaders/ribbon.vert.c"
+
 static GLuint mask_texture;
 static GLuint brush_texture;
 
 #define RADIAL_GRADIENT_SIZE 64
 
-#include "../build/assets/images/pencil.png.c"
-void upload_texture() {
+// CPU copies of the brush textures, shared by the GL upload and the software rasterizer
+static struct {
+	uint8_t mask[RADIAL_GRADIENT_SIZE][RADIAL_GRADIENT_SIZE];
+	uint8_t* brush;
+	int brush_width;
+	int brush_height;
+	
+	struct raster_texture raster_mask;
+	struct raster_texture raster_brush;
+} brush_images;
 
-	static uint8_t pix[RADIAL_GRADIENT_SIZE][RADIAL_GRADIENT_SIZE];
+#include "../build/assets/images/pencil.png.c"
+static void load_brush_images() {
+	uint8_t (*pix)[RADIAL_GRADIENT_SIZE] = brush_images.mask;
 	const uint8_t midpoint = RADIAL_GRADIENT_SIZE / 2;
 	const float scale = 2.5f;
 
@@ -172,19 +611,24 @@ void upload_texture() {
 			pix[y][x] = a * 255;
 		}
 	}
+	
+	int brush_channels;
+	stbi_set_flip_vertically_on_load(1);
+	brush_images.brush = stbi_load_from_memory(src_assets_images_pencil_png, src_assets_images_pencil_png_len, &brush_images.brush_width, &brush_images.brush_height, &brush_channels, 1);
+	assert(brush_images.brush);
+	
+	raster_texture_init(&brush_images.raster_mask, &brush_images.mask[0][0], RADIAL_GRADIENT_SIZE, RADIAL_GRADIENT_SIZE);
+	raster_texture_init(&brush_images.raster_brush, brush_images.brush, brush_images.brush_width, brush_images.brush_height);
+}
 
+void upload_texture() {
 	glGenTextures(1, &mask_texture);
 	glBindTexture(GL_TEXTURE_2D, mask_texture);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, RADIAL_GRADIENT_SIZE, RADIAL_GRADIENT_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, pix);
-
-	int brush_width, brush_height, brush_channels;
-	stbi_set_flip_vertically_on_load(1);
-	GLubyte* brush_pix = stbi_load_from_memory(src_assets_images_pencil_png, src_assets_images_pencil_png_len, &brush_width, &brush_height, &brush_channels, 0);
-	assert(brush_pix);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, RADIAL_GRADIENT_SIZE, RADIAL_GRADIENT_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, brush_images.mask);
 	
 	glGenTextures(1, &brush_texture);
 	glBindTexture(GL_TEXTURE_2D, brush_texture);
@@ -192,14 +636,82 @@ void upload_texture() {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, brush_width, brush_height, 0, GL_RED, GL_UNSIGNED_BYTE, brush_pix);
-
-	stbi_image_free(brush_pix);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, brush_images.brush_width, brush_images.brush_height, 0, GL_RED, GL_UNSIGNED_BYTE, brush_images.brush);
 }
 
 static GLuint plane_vao;
 static GLuint plane_vbo;
 
+static GLuint stamps_vbo;
+static struct {
+	struct lb_stroke_stamp* stamps;
+	uint32_t cap;
+} reversed_buffer;
+
+struct ribbon_vertex {
+	vec2 position;
+	vec2 tex_coord;
+};
+
+static GLuint ribbon_vao;
+static GLuint ribbon_vbo;
+static struct {
+	struct ribbon_vertex* vertices;
+	uint32_t cap;
+} ribbon_buffer;
+
+// Per-segment record of the curve shader's segments buffer, 3 RGBA texels
+struct curve_segment {
+	vec2 a;
+	vec2 h1;
+	vec2 h2;
+	vec2 b;
+	float stamps_first;
+	float steps;
+	float length_begin; // unused by the shader
+	float length; // unused by the shader, no stamps when zero
+};
+
+// Entries of the arc-length tables the curve shader searches, every (BEZIER_DISTANCE_CACHE_SIZE/CURVE_LENGTHS_SIZE)th
+// of the CPU table's, packed four to an RGBA32F texel. Keeps large documents within the texture buffer limit.
+#define CURVE_LENGTHS_SIZE 256
+#define CURVE_LENGTHS_TEXELS (CURVE_LENGTHS_SIZE / 4)
+_Static_assert(BEZIER_DISTANCE_CACHE_SIZE % CURVE_LENGTHS_SIZE == 0, "curve tables must subsample the distance cache");
+
+// The curve shader's segment records and arc-length tables, both at the slots of the packed vertex storage
+static struct {
+	GLuint segments_tbo;
+	GLuint segments_texture;
+	GLuint lengths_tbo;
+	GLuint lengths_texture;
+	GLuint random_samples_texture;
+	
+	struct curve_segment* segments; // CPU copy of the records
+	uint32_t cap; // slots both buffers have room for
+	uint32_t max_cap; // slots GL_MAX_TEXTURE_BUFFER_SIZE allows
+} curve_buffer;
+
+// Number of stamps of the segments lying at or before the given arc length
+static uint32_t curve_stamps_upper_bound(const struct curve_segment* segments, uint32_t segments_len, float length) {
+	uint32_t count = 0;
+	for(uint32_t i = 0; i < segments_len; i++) {
+		const struct curve_segment* segment = &segments[i];
+		if(length < segment->length_begin) break;
+		
+		float segment_length = segment->length;
+		if(segment_length <= 0.0f) continue;
+		uint32_t steps = (uint32_t)segment->steps;
+		uint32_t p = (uint32_t)floor((length - segment->length_begin) / segment_length * steps);
+		if(p >= steps) {
+			count += steps + 1;
+			continue;
+		}
+		count += p + 1;
+		break;
+	}
+	return count;
+}
+
 void upload_plane() {
 	static float vertices[] = {
 	//  Position   // Texcoords
@@ -231,12 +743,124 @@ void upload_plane() {
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, vertex_stride, (char*)8);
 	glEnableVertexAttribArray(1);
 	glCheckError();
+	
+	// Instanced stamp attributes, advanced once per quad
+	glGenBuffers(1, &stamps_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, stamps_vbo);
+	glCheckError();
+	
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(struct lb_stroke_stamp), (void*)offsetof(struct lb_stroke_stamp, translation));
+	glVertexAttribDivisor(2, 1);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(struct lb_stroke_stamp), (void*)offsetof(struct lb_stroke_stamp, rotation));
+	glVertexAttribDivisor(3, 1);
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(struct lb_stroke_stamp), (void*)offsetof(struct lb_stroke_stamp, scale));
+	glVertexAttribDivisor(4, 1);
+	glEnableVertexAttribArray(4);
+	glCheckError();
 }
 
-void lb_strokes_init() {
+static void upload_ribbon() {
+	glGenVertexArrays(1, &ribbon_vao);
+	glBindVertexArray(ribbon_vao);
+	glGenBuffers(1, &ribbon_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, ribbon_vbo);
+	glCheckError();
+	
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(struct ribbon_vertex), (void*)offsetof(struct ribbon_vertex, position));
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct ribbon_vertex), (void*)offsetof(struct ribbon_vertex, tex_coord));
+	glEnableVertexAttribArray(1);
+	glCheckError();
+}
+
+// Replaces the texture's buffer with a larger one starting with the same contents
+static void grow_texture_buffer(GLuint* tbo, GLuint texture, GLenum format, GLsizeiptr size, GLsizeiptr grown_size) {
+	GLuint grown;
+	glGenBuffers(1, &grown);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+	glBufferData(GL_COPY_WRITE_BUFFER, grown_size, NULL, GL_DYNAMIC_DRAW);
+	if(size) {
+		glBindBuffer(GL_COPY_READ_BUFFER, *tbo);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glDeleteBuffers(1, tbo);
+	*tbo = grown;
+	
+	glBindTexture(GL_TEXTURE_BUFFER, texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, format, grown);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glCheckError();
+}
+
+// Makes room in the curve buffers for every slot of the vertex storage, at most max_cap
+static void reserve_curve_buffers(uint32_t cap) {
+	assert(cap <= curve_buffer.max_cap);
+	if(cap <= curve_buffer.cap) return;
+	uint32_t grown = curve_buffer.cap * 2;
+	if(grown > curve_buffer.max_cap) grown = curve_buffer.max_cap;
+	if(cap < grown) cap = grown;
+	
+	curve_buffer.segments = realloc(curve_buffer.segments, sizeof(struct curve_segment) * cap);
+	assert(curve_buffer.segments);
+	grow_texture_buffer(&curve_buffer.segments_tbo, curve_buffer.segments_texture, GL_RGBA32F,
+		sizeof(struct curve_segment) * curve_buffer.cap, sizeof(struct curve_segment) * cap);
+	grow_texture_buffer(&curve_buffer.lengths_tbo, curve_buffer.lengths_texture, GL_RGBA32F,
+		sizeof(float) * CURVE_LENGTHS_SIZE * curve_buffer.cap, sizeof(float) * CURVE_LENGTHS_SIZE * cap);
+	curve_buffer.cap = cap;
+}
+
+static void upload_curve_buffers() {
+	// The lengths tables are the largest per slot, 3 texels of records fit whenever they do
+	GLint max_texels;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+	curve_buffer.max_cap = max_texels / CURVE_LENGTHS_TEXELS;
+	
+	glGenBuffers(1, &curve_buffer.segments_tbo);
+	glBindBuffer(GL_TEXTURE_BUFFER, curve_buffer.segments_tbo);
+	glGenTextures(1, &curve_buffer.segments_texture);
+	glBindTexture(GL_TEXTURE_BUFFER, curve_buffer.segments_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, curve_buffer.segments_tbo);
+	
+	glGenBuffers(1, &curve_buffer.lengths_tbo);
+	glBindBuffer(GL_TEXTURE_BUFFER, curve_buffer.lengths_tbo);
+	glGenTextures(1, &curve_buffer.lengths_texture);
+	glBindTexture(GL_TEXTURE_BUFFER, curve_buffer.lengths_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, curve_buffer.lengths_tbo);
+	
+	// The jitter lookup table never changes
+	GLuint random_samples_tbo;
+	glGenBuffers(1, &random_samples_tbo);
+	glBindBuffer(GL_TEXTURE_BUFFER, random_samples_tbo);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(random_samples), random_samples, GL_STATIC_DRAW);
+	glGenTextures(1, &curve_buffer.random_samples_texture);
+	glBindTexture(GL_TEXTURE_BUFFER, curve_buffer.random_samples_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, random_samples_tbo);
+	
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glCheckError();
+}
+
+void lb_strokes_init_headless() {
 	srand(0);
 	for(size_t i = 0; i < RANDOM_SAMPLE_SIZE; i++) random_samples[i] = rand() / (float)RAND_MAX;
-		
+	
+	load_brush_images();
+	
+	data.segments_index = spatial_init(SEGMENTS_INDEX_CELL_SIZE);
+	data.stamps_pool = pool_classes_init(
+		sizeof(struct lb_stroke_stamp) * STAMPS_POOL_MIN_STAMPS,
+		sizeof(struct lb_stroke_stamp) * STAMPS_POOL_MAX_STAMPS,
+		STAMPS_POOL_SLAB_BYTES);
+}
+
+void lb_strokes_init() {
+	lb_strokes_init_headless();
+	
 	// Line shader
 	{
 		static const char* uniformNames[] = {
@@ -257,9 +881,6 @@ void lb_strokes_init() {
 		static const char* uniformNames[] = {
 			"projection",
 			"pan",
-			"translation",
-			"scale",
-			"rotation",
 			"brushColor",
 			"brushAlpha",
 			"maskTex",
@@ -272,6 +893,50 @@ void lb_strokes_init() {
 			uniformNames, sizeof(uniformNames)/sizeof(uniformNames[0]), &brush_shader);
 	}
 	
+	// Brush curve shader
+	{
+		static const char* uniformNames[] = {
+			"projection",
+			"pan",
+			"brushColor",
+			"brushAlpha",
+			"maskTex",
+			"brushTex",
+			"segments",
+			"lengths",
+			"randomSamples",
+			"segmentsFirst",
+			"segmentsLen",
+			"stampsFirst",
+			"stampsLen",
+			"reverse",
+			"strokeScale",
+			"jitter"
+		};
+
+		buildProgram(
+			loadShader(GL_VERTEX_SHADER, (char*)src_assets_shaders_brush_curve_vert, (int*)&src_assets_shaders_brush_curve_vert_len),
+			loadShader(GL_FRAGMENT_SHADER, (char*)src_assets_shaders_brush_frag, (int*)&src_assets_shaders_brush_frag_len),
+			uniformNames, sizeof(uniformNames)/sizeof(uniformNames[0]), &brush_curve_shader);
+	}
+	
+	// Ribbon shader
+	{
+		static const char* uniformNames[] = {
+			"projection",
+			"pan",
+			"brushColor",
+			"brushAlpha",
+			"maskTex",
+			"brushTex"
+		};
+
+		buildProgram(
+			loadShader(GL_VERTEX_SHADER, (char*)src_assets_shaders_ribbon_vert, (int*)&src_assets_shaders_ribbon_vert_len),
+			loadShader(GL_FRAGMENT_SHADER, (char*)src_assets_shaders_ribbon_frag, (int*)&src_assets_shaders_ribbon_frag_len),
+			uniformNames, sizeof(uniformNames)/sizeof(uniformNames[0]), &ribbon_shader);
+	}
+	
 
 	glGenVertexArrays(1, &gl_lines.vao);
 	glBindVertexArray(gl_lines.vao);
@@ -283,8 +948,7 @@ void lb_strokes_init() {
 	size_t vertexStride = 0;
 	vertexStride += sizeof(GLfloat) * 2;
 	
-	glBindBuffer(GL_ARRAY_BUFFER, gl_lines.vbo);
-	glBufferData(GL_ARRAY_BUFFER, (GLsizei) sizeof(vec2) * MAX_STROKE_VERTICES, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, gl_lines.vbo); // storage is respecified with each frame's overlay
 	glCheckError();
 	
 	// Enable vertex attributes
@@ -295,15 +959,15 @@ void lb_strokes_init() {
 	glCheckError();
 
 	upload_plane();
+	upload_ribbon();
 	upload_texture();
-	
-	data.vertices_pool = pool_init(sizeof(struct bezier_point) * MAX_STROKE_VERTICES, MAX_STROKES);
+	upload_curve_buffers();
+}
+
+struct pool_stats lb_strokes_stamps_pool_stats() {
+	return pool_classes_get_stats(data.stamps_pool);
 }
 
-struct lb_stroke* lb_strokes_selected = NULL;
-struct lb_stroke* lb_strokes_selected_tmp = NULL;
-struct bezier_point* lb_strokes_selected_vertex = NULL;
-static vec2* drag_vec = NULL;
 static uint8_t drag_handle_idx = 0;
 static vec2 drag_start;
 static float select_tolerance_dist = 8.0f;
@@ -340,165 +1004,1023 @@ static enum draw_state lb_stroke_getDrawStateForTime(const struct lb_stroke* str
 		acc += stroke->exit.duration;
 		if(time < acc) return EXITING;
 	}
-	return NONE;
+	return NONE;
+}
+
+// Time at which the stroke stops being drawn, summed in the same order as lb_stroke_getDrawStateForTime
+static float lb_stroke_getEndTime(const struct lb_stroke* stroke) {
+	float acc = stroke->global_start_time;
+	if(stroke->enter.animate_method != ANIMATE_NONE) acc += stroke->enter.duration;
+	acc += stroke->full_duration;
+	if(stroke->exit.animate_method != ANIMATE_NONE) acc += stroke->exit.duration;
+	return acc;
+}
+
+// Index of stroke lifetimes, rebuilt after strokes are added or removed.
+// Timing is only edited on the selected stroke, so that is the only one checked for changes.
+static struct interval_sweep* stroke_timeline() {
+	if(!data.timeline_dirty && lb_strokes_selected) {
+		struct stroke_hot* hot = stroke_hot(lb_strokes_selected);
+		if(hot->begin != lb_strokes_selected->global_start_time || hot->end != lb_stroke_getEndTime(lb_strokes_selected)) {
+			data.timeline_dirty = true;
+		}
+	}
+	
+	if(data.timeline_dirty) {
+		sweep_clear(&data.timeline);
+		for(size_t i = 0; i < data.strokes_len; i++) {
+			data.hot[i].begin = data.strokes[i].global_start_time;
+			data.hot[i].end = lb_stroke_getEndTime(&data.strokes[i]);
+			sweep_add(&data.timeline, data.hot[i].begin, data.hot[i].end);
+		}
+		data.timeline_dirty = false;
+	}
+	return &data.timeline;
+}
+
+// Drawn stamps are a prefix of the stroke, or a suffix when drawing in reverse,
+// including the first stamp past the drawn length
+static bool stamps_drawn_range(const struct lb_stroke_stamps* stamps, float percent_drawn, bool reverse, uint32_t* first, uint32_t* count) {
+	if(!stamps->len) return false;
+	
+	float total_length_drawn = stamps->length*percent_drawn;
+	if(total_length_drawn <= 0.0f) return false;
+	
+	if(percent_drawn >= 1.0f) {
+		*first = 0;
+		*count = stamps->len;
+	} else if(reverse) {
+		*first = stamps_upper_bound(stamps, stamps->length - total_length_drawn);
+		if(*first > 0) (*first)--;
+		*count = stamps->len - *first;
+	} else {
+		*first = 0;
+		*count = stamps_upper_bound(stamps, total_length_drawn);
+		if(*count < stamps->len) (*count)++;
+	}
+	return true;
+}
+
+// Draws the stroke's cached stamps, one instance each
+static void render_stroke_stamps(struct lb_stroke* stroke, float percent_drawn, bool reverse) {
+	const struct lb_stroke_stamps* stamps = stroke_stamps(stroke);
+	uint32_t first, count;
+	if(!stamps_drawn_range(stamps, percent_drawn, reverse, &first, &count)) return;
+	
+	// Reversed strokes are laid down back to front so the leading stamps stay on top
+	const struct lb_stroke_stamp* upload = &stamps->stamps[first];
+	if(reverse) {
+		if(count > reversed_buffer.cap) {
+			reversed_buffer.cap = count * 2;
+			reversed_buffer.stamps = realloc(reversed_buffer.stamps, sizeof(struct lb_stroke_stamp) * reversed_buffer.cap);
+			assert(reversed_buffer.stamps);
+		}
+		for(uint32_t p = 0; p < count; p++) reversed_buffer.stamps[p] = stamps->stamps[first + count-1 - p];
+		upload = reversed_buffer.stamps;
+	}
+	
+	// Respecifying the whole store orphans the previous stroke's data instead of stalling on it
+	glBindBuffer(GL_ARRAY_BUFFER, stamps_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(struct lb_stroke_stamp) * count, upload, GL_STREAM_DRAW);
+	glDrawArraysInstanced(GL_TRIANGLES, 0, 6, count);
+}
+
+// Brings the curve buffers' copy of the stroke up to date. Arc-length tables are only uploaded for the segments
+// edited since the last upload, or for all of them once the stroke's range may have moved to other slots.
+// The small records are laid out again whenever anything about them changed.
+static void upload_stroke_curves(struct lb_stroke* stroke) {
+	struct stroke_hot* hot = stroke_hot(stroke);
+	struct stroke_curves* curves = &hot->curves;
+	uint32_t segments_len = hot->vertices_len - 1;
+	
+	if(!curves->uploaded || curves->vertices_moves != data.vertices_moves) {
+		curves->tables_begin = 0;
+		curves->tables_end = segments_len;
+		curves->records_valid = false;
+	}
+	if(curves->tables_end > segments_len) curves->tables_end = segments_len;
+	
+	glBindBuffer(GL_TEXTURE_BUFFER, curve_buffer.lengths_tbo);
+	for(uint32_t s = curves->tables_begin; s < curves->tables_end; s++) {
+		const struct bezier_distance_cache* distances = segment_distances(stroke, s);
+		float lengths[CURVE_LENGTHS_SIZE];
+		const uint32_t stride = BEZIER_DISTANCE_CACHE_SIZE / CURVE_LENGTHS_SIZE;
+		for(uint32_t i = 0; i < CURVE_LENGTHS_SIZE; i++) lengths[i] = distances->lengths[(i+1)*stride - 1];
+		glBufferSubData(GL_TEXTURE_BUFFER, sizeof(lengths) * (hot->vertices_first + s), sizeof(lengths), lengths);
+	}
+	curves->tables_begin = curves->tables_end = 0;
+	
+	if(!curves->records_valid || curves->scale != stroke->scale) {
+		const struct bezier_point* vertices = stroke_vertices(stroke);
+		struct curve_segment* segments = &curve_buffer.segments[hot->vertices_first];
+		uint32_t stamps_len = 0;
+		float length = 0.0f;
+		for(uint32_t s = 0; s < segments_len; s++) {
+			float segment_length = segment_distances(stroke, s)->total;
+			segments[s] = (struct curve_segment){
+				.a = vertices[s].anchor,
+				.h1 = vertices[s].handles[1],
+				.h2 = vertices[s+1].handles[0],
+				.b = vertices[s+1].anchor,
+				.stamps_first = stamps_len,
+				.steps = ceil(segment_length / (stroke->scale / 2.0f)),
+				.length_begin = length,
+				.length = segment_length
+			};
+			if(segment_length > 0.0f) stamps_len += (uint32_t)segments[s].steps + 1; // coincident points have nothing to stamp
+			length += segment_length;
+		}
+		
+		glBindBuffer(GL_TEXTURE_BUFFER, curve_buffer.segments_tbo);
+		glBufferSubData(GL_TEXTURE_BUFFER, sizeof(struct curve_segment) * hot->vertices_first, sizeof(struct curve_segment) * segments_len, segments);
+		curves->records_valid = true;
+		curves->scale = stroke->scale;
+		curves->stamps_len = stamps_len;
+		curves->length = length;
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	
+	curves->uploaded = true;
+	curves->vertices_moves = data.vertices_moves;
+}
+
+// One instanced draw, the curve shader places every stamp from gl_InstanceID. The stroke's segments stay in the
+// curve buffers, so an unedited stroke only sets the per-draw uniforms.
+static void render_stroke_curves(struct lb_stroke* stroke, float percent_drawn, bool reverse) {
+	upload_stroke_curves(stroke);
+	const struct stroke_hot* hot = stroke_hot(stroke);
+	const struct stroke_curves* curves = &hot->curves;
+	const struct curve_segment* segments = &curve_buffer.segments[hot->vertices_first];
+	uint32_t segments_len = hot->vertices_len - 1;
+	uint32_t stamps_len = curves->stamps_len;
+	float total_length = curves->length;
+	if(!stamps_len) return;
+	
+	float total_length_drawn = total_length*percent_drawn;
+	if(total_length_drawn <= 0.0f) return;
+	
+	// Same prefix/suffix selection as render_stroke_stamps, counted per segment instead of per stamp
+	uint32_t first, count;
+	if(percent_drawn >= 1.0f) {
+		first = 0;
+		count = stamps_len;
+	} else if(reverse) {
+		first = curve_stamps_upper_bound(segments, segments_len, total_length - total_length_drawn);
+		if(first > 0) first--;
+		count = stamps_len - first;
+	} else {
+		first = 0;
+		count = curve_stamps_upper_bound(segments, segments_len, total_length_drawn);
+		if(count < stamps_len) count++;
+	}
+	
+	glUniform1i(brush_curve_shader.uniforms[BRUSH_CURVE_UNIFORM_SEGMENTS_FIRST], hot->vertices_first);
+	glUniform1i(brush_curve_shader.uniforms[BRUSH_CURVE_UNIFORM_SEGMENTS_LEN], segments_len);
+	glUniform1i(brush_curve_shader.uniforms[BRUSH_CURVE_UNIFORM_STAMPS_FIRST], first);
+	glUniform1i(brush_curve_shader.uniforms[BRUSH_CURVE_UNIFORM_STAMPS_LEN], count);
+	glUniform1i(brush_curve_shader.uniforms[BRUSH_CURVE_UNIFORM_REVERSE], reverse);
+	glUniform1f(brush_curve_shader.uniforms[BRUSH_CURVE_UNIFORM_SCALE], stroke->scale);
+	glUniform1f(brush_curve_shader.uniforms[BRUSH_CURVE_UNIFORM_JITTER], stroke->jitter);
+	glDrawArraysInstanced(GL_TRIANGLES, 0, 6, count);
+}
+
+// Sweeps the brush across a single triangle strip following the cached stamps,
+// so every covered pixel is shaded about once instead of once per overlapping stamp
+static void render_stroke_ribbon(struct lb_stroke* stroke, float percent_drawn, bool reverse) {
+	const struct lb_stroke_stamps* stamps = stroke_stamps(stroke);
+	uint32_t first, count;
+	if(!stamps_drawn_range(stamps, percent_drawn, reverse, &first, &count)) return;
+	if(count < 2) return;
+	
+	if(count*2 > ribbon_buffer.cap) {
+		ribbon_buffer.cap = count * 4;
+		ribbon_buffer.vertices = realloc(ribbon_buffer.vertices, sizeof(struct ribbon_vertex) * ribbon_buffer.cap);
+		assert(ribbon_buffer.vertices);
+	}
+	
+	// The strip ends exactly at the drawn length rather than at the next stamp
+	float clip_begin = reverse ? stamps->length*(1.0f - percent_drawn) : 0.0f;
+	float clip_end = reverse ? stamps->length : stamps->length*percent_drawn;
+	
+	for(uint32_t p = 0; p < count; p++) {
+		uint32_t k = first + p;
+		const struct lb_stroke_stamp* stamp = &stamps->stamps[k];
+		const struct lb_stroke_stamp* prev = &stamps->stamps[k > 0 ? k-1 : k];
+		const struct lb_stroke_stamp* next = &stamps->stamps[k+1 < stamps->len ? k+1 : k];
+		
+		vec2 tangent = vec2_sub(next->translation, prev->translation);
+		float tangent_len = vec2_len(tangent);
+		vec2 normal = tangent_len > 0.0f ? (vec2){-tangent.y / tangent_len, tangent.x / tangent_len} : (vec2){0, 1};
+		
+		vec2 position = stamp->translation;
+		float length = stamp->length;
+		const struct lb_stroke_stamp* inner = p == 0 ? next : prev;
+		float clip = length < clip_begin ? clip_begin : length > clip_end ? clip_end : length;
+		if(clip != length && inner->length != length) {
+			float t = (clip - length) / (inner->length - length);
+			position = vec2_add(position, (vec2){(inner->translation.x - position.x) * t, (inner->translation.y - position.y) * t});
+			length = clip;
+		}
+		
+		float half_width = stamp->scale / 2.0f;
+		float u = length / stroke->scale;
+		ribbon_buffer.vertices[p*2] = (struct ribbon_vertex){
+			.position = {position.x + normal.x*half_width, position.y + normal.y*half_width},
+			.tex_coord = {u, 0.0f}
+		};
+		ribbon_buffer.vertices[p*2+1] = (struct ribbon_vertex){
+			.position = {position.x - normal.x*half_width, position.y - normal.y*half_width},
+			.tex_coord = {u, 1.0f}
+		};
+	}
+	
+	glBindBuffer(GL_ARRAY_BUFFER, ribbon_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(struct ribbon_vertex) * count*2, ribbon_buffer.vertices, GL_STREAM_DRAW);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, count*2);
+}
+
+// How much of the stroke is drawn at the given time and with which alpha, false when it isn't visible
+static bool stroke_draw_params(const struct lb_stroke* stroke, float time, float* percent_drawn, bool* reverse, float* alpha) {
+	enum draw_state state = lb_stroke_getDrawStateForTime(stroke, time);
+	*reverse = false;
+	
+	enum lb_animate_method method = ANIMATE_NONE;
+	switch(state) {
+		case NONE:
+			return false;
+		case FULL:
+			*percent_drawn = 1;
+			break;
+		case ENTERING:
+			*percent_drawn = EasingFuncs[stroke->enter.easing_method](map(
+				time,
+				stroke->global_start_time,
+				stroke->global_start_time + stroke->enter.duration,
+				0, 1));
+			*reverse = stroke->enter.draw_reverse;
+			method = stroke->enter.animate_method;
+			break;
+		case EXITING: {
+			float begin = stroke->global_start_time +
+				(stroke->enter.animate_method == ANIMATE_NONE ? 0 : stroke->enter.duration) +
+				stroke->full_duration;
+			float end = begin + stroke->exit.duration;
+			*percent_drawn = EasingFuncs[stroke->exit.easing_method](map(
+				time,
+				begin, end,
+				1, 0));
+			*reverse = stroke->exit.draw_reverse;
+			method = stroke->exit.animate_method;
+			break;
+		}
+	}
+	
+	if(method == ANIMATE_FADE) {
+		*alpha = *percent_drawn;
+		*percent_drawn = 1;
+	} else {
+		*alpha = 1;
+	}
+	return true;
+}
+
+void lb_strokes_render_strokes(const float time, const mat4 matrix, const vec2 pan) {
+	glEnable(GL_BLEND);
+	glBlendEquation(GL_FUNC_ADD);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	
+	glDisable(GL_DEPTH_TEST);
+	
+	// Documents too large for the curve buffers are stamped on the CPU instead
+	enum lb_render_mode mode = lb_strokes_render_mode;
+	if(mode == RENDER_STAMPS_GPU && data.vertices_cap > curve_buffer.max_cap) mode = RENDER_STAMPS;
+	
+	// All brush programs share the leading uniforms
+	struct shaderProgram* shader = &brush_shader;
+	switch(mode) {
+		case RENDER_STAMPS: break;
+		case RENDER_STAMPS_GPU: shader = &brush_curve_shader; break;
+		case RENDER_RIBBON: shader = &ribbon_shader; break;
+	}
+	
+	glUseProgram(shader->program);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	glUniform2f(shader->uniforms[BRUSH_UNIFORM_PAN], pan.x, pan.y);
+	glUniformMatrix4fv(shader->uniforms[BRUSH_UNIFORM_PROJECTION], 1, GL_FALSE, (const GLfloat*) matrix);
+	
+	glUniform1i(shader->uniforms[BRUSH_UNIFORM_MASK_TEXTURE], 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, mask_texture);
+	
+	glUniform1i(shader->uniforms[BRUSH_UNIFORM_BRUSH_TEXTURE], 1);
+	glActiveTexture(GL_TEXTURE0+1);
+	glBindTexture(GL_TEXTURE_2D, brush_texture);
+	
+	if(mode == RENDER_STAMPS_GPU) {
+		reserve_curve_buffers(data.vertices_cap);
+		
+		glUniform1i(shader->uniforms[BRUSH_CURVE_UNIFORM_SEGMENTS], 2);
+		glActiveTexture(GL_TEXTURE0+2);
+		glBindTexture(GL_TEXTURE_BUFFER, curve_buffer.segments_texture);
+		
+		glUniform1i(shader->uniforms[BRUSH_CURVE_UNIFORM_LENGTHS], 3);
+		glActiveTexture(GL_TEXTURE0+3);
+		glBindTexture(GL_TEXTURE_BUFFER, curve_buffer.lengths_texture);
+		
+		glUniform1i(shader->uniforms[BRUSH_CURVE_UNIFORM_RANDOM_SAMPLES], 4);
+		glActiveTexture(GL_TEXTURE0+4);
+		glBindTexture(GL_TEXTURE_BUFFER, curve_buffer.random_samples_texture);
+	}
+	
+	glBindVertexArray(mode == RENDER_RIBBON ? ribbon_vao : plane_vao);
+	
+	// Only the strokes alive at this time are visited, in draw order
+	uint32_t active_len;
+	const uint32_t* active = sweep_advance(stroke_timeline(), time, &active_len);
+	
+	for(uint32_t a = 0; a < active_len; a++) {
+		uint32_t i = active[a];
+		if(data.hot[i].vertices_len < 2) continue;
+		
+		struct lb_stroke* stroke = &data.strokes[i];
+		float percent_drawn, alpha;
+		bool reverse;
+		if(!stroke_draw_params(stroke, time, &percent_drawn, &reverse, &alpha)) continue;
+		
+		glUniform1f(shader->uniforms[BRUSH_UNIFORM_ALPHA], alpha);
+		glUniform4f(shader->uniforms[BRUSH_UNIFORM_COLOR], stroke->color.r, stroke->color.g, stroke->color.b, stroke->color.a);
+		
+		switch(mode) {
+			case RENDER_STAMPS:
+				render_stroke_stamps(stroke, percent_drawn, reverse);
+				break;
+			case RENDER_STAMPS_GPU:
+				render_stroke_curves(stroke, percent_drawn, reverse);
+				break;
+			case RENDER_RIBBON:
+				render_stroke_ribbon(stroke, percent_drawn, reverse);
+				break;
+		}
+	}
+}
+
+static GLuint export_fbo;
+static GLuint export_rbo;
+
+#define EXPORT_READBACK_BUFFERS 3
+#define EXPORT_TEXTURE_LIMIT 16384 // the largest texture side common browsers and GPUs accept
+
+// Frames are read back through a ring of pixel-pack buffers, so the GPU renders the next
+// frames while earlier ones are copied out and encoded
+static struct {
+	GLuint buffers[EXPORT_READBACK_BUFFERS];
+	GLsync fences[EXPORT_READBACK_BUFFERS];
+	GLenum format; // GL_RGBA, or GL_BGRA when the driver prefers it
+} readback;
+
+// Stamps the same strokes as lb_strokes_render_strokes on the CPU, into the same bottom-up layout as glReadPixels.
+// Only reads the stroke data, so frames can be rendered concurrently each with their own timeline.
+static void render_stroke_export_frame_software(struct interval_sweep* timeline, const float time, uint8_t* pixels, vec2 size, vec2 framebuffer_size, vec2 offset) {
+	struct raster_image image = {
+		.pixels = pixels,
+		.width = (uint32_t)framebuffer_size.x,
+		.height = (uint32_t)framebuffer_size.y
+	};
+	struct raster_view view = {
+		.origin = {offset.x, offset.y + size.y},
+		.scale = {framebuffer_size.x / size.x, -framebuffer_size.y / size.y}
+	};
+	raster_clear(&image);
+	
+	uint32_t active_len;
+	const uint32_t* active = sweep_advance(timeline, time, &active_len);
+	
+	for(uint32_t a = 0; a < active_len; a++) {
+		uint32_t i = active[a];
+		if(data.hot[i].vertices_len < 2) continue;
+		
+		struct lb_stroke* stroke = &data.strokes[i];
+		float percent_drawn, alpha;
+		bool reverse;
+		if(!stroke_draw_params(stroke, time, &percent_drawn, &reverse, &alpha)) continue;
+		
+		const struct lb_stroke_stamps* stamps = &data.hot[i].stamps;
+		assert(stamps->valid);
+		uint32_t first, count;
+		if(!stamps_drawn_range(stamps, percent_drawn, reverse, &first, &count)) continue;
+		
+		raster_stamps(&image, &view, &brush_images.raster_brush, &brush_images.raster_mask,
+			&stamps->stamps[first], count, reverse, stroke->color, alpha);
+	}
+}
+
+// Queues the frame's transfer into the readback slot, finish_export_readback collects it
+static void render_stroke_export_frame(const float time, uint32_t slot, vec2 size, vec2 framebuffer_size, vec2 offset) {
+	
+	glBindFramebuffer(GL_FRAMEBUFFER, export_fbo);
+	glBindRenderbuffer(GL_RENDERBUFFER, export_rbo);
+	glClearColor(0,0,0,0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	
+	update_ortho(crop_ortho, offset.x, offset.x + size.x, offset.y + size.y, offset.y, 0, 1);
+	lb_strokes_render_strokes(time, crop_ortho, (vec2){0,0});
+	
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffers[slot]);
+	glReadPixels(0, 0, framebuffer_size.x, framebuffer_size.y, readback.format, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	readback.fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// Waits for the slot's transfer and copies it out as RGBA
+static bool finish_export_readback(uint32_t slot, uint8_t* data, size_t bytes) {
+	GLenum wait;
+	do {
+		wait = glClientWaitSync(readback.fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+	} while(wait == GL_TIMEOUT_EXPIRED);
+	glDeleteSync(readback.fences[slot]);
+	readback.fences[slot] = 0;
+	if(wait == GL_WAIT_FAILED) {
+		fprintf(stderr, "Could not wait for the frame readback.\n");
+		return false;
+	}
+	
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffers[slot]);
+	const uint8_t* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+	if(!pixels) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		fprintf(stderr, "Could not map the frame readback.\n");
+		return false;
+	}
+	
+	if(readback.format == GL_BGRA) {
+		for(size_t p = 0; p < bytes; p += 4) {
+			data[p] = pixels[p+2];
+			data[p+1] = pixels[p+1];
+			data[p+2] = pixels[p];
+			data[p+3] = pixels[p+3];
+		}
+	} else {
+		memcpy(data, pixels, bytes);
+	}
+	
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	return true;
+}
+
+// The driver's preferred read format for the bound framebuffer, when it has one we can take as bytes
+static GLenum preferred_readback_format() {
+	if(GLEW_VERSION_4_1 || GLEW_ARB_ES2_compatibility) {
+		GLint format = 0, type = 0;
+		glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_FORMAT, &format);
+		glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_TYPE, &type);
+		if(format == GL_BGRA && (type == GL_UNSIGNED_BYTE || type == GL_UNSIGNED_INT_8_8_8_8_REV)) return GL_BGRA;
+	}
+	return GL_RGBA;
+}
+
+// How one stroke is drawn in a frame
+struct export_stroke_state {
+	uint32_t stroke;
+	float percent_drawn;
+	float alpha;
+	bool reverse;
+};
+
+struct export_frame_state {
+	struct export_stroke_state* strokes;
+	uint32_t len;
+	uint32_t cap;
+};
+
+// Every stroke visible at `time` with what it is drawn with, in draw order, the same strokes the renderers visit
+static void export_frame_state(float time, struct export_frame_state* state) {
+	state->len = 0;
+	uint32_t active_len;
+	const uint32_t* active = sweep_advance(stroke_timeline(), time, &active_len);
+	for(uint32_t a = 0; a < active_len; a++) {
+		uint32_t i = active[a];
+		if(data.hot[i].vertices_len < 2) continue;
+		
+		struct export_stroke_state stroke = {.stroke = i};
+		if(!stroke_draw_params(&data.strokes[i], time, &stroke.percent_drawn, &stroke.reverse, &stroke.alpha)) continue;
+		
+		if(state->len == state->cap) {
+			state->cap = state->cap ? state->cap * 2 : 64;
+			state->strokes = realloc(state->strokes, sizeof(struct export_stroke_state) * state->cap);
+			assert(state->strokes);
+		}
+		state->strokes[state->len++] = stroke;
+	}
+}
+
+static bool export_frame_states_equal(const struct export_frame_state* a, const struct export_frame_state* b) {
+	if(a->len != b->len) return false;
+	for(uint32_t i = 0; i < a->len; i++) {
+		const struct export_stroke_state* x = &a->strokes[i];
+		const struct export_stroke_state* y = &b->strokes[i];
+		if(x->stroke != y->stroke || x->percent_drawn != y->percent_drawn || x->alpha != y->alpha || x->reverse != y->reverse) return false;
+	}
+	return true;
+}
+
+// Lists the frames that draw something other than the frame before them, holds only need their first frame rendered.
+// Returns how many there are.
+static uint32_t find_unique_frames(uint32_t frames, float frametime, uint32_t* unique) {
+	struct export_frame_state states[2] = {0};
+	uint32_t unique_len = 0;
+	for(uint32_t i = 0; i < frames; i++) {
+		struct export_frame_state* state = &states[i % 2];
+		export_frame_state(lb_strokes_export_range_begin + i * frametime, state);
+		if(i == 0 || !export_frame_states_equal(state, &states[(i+1) % 2])) unique[unique_len++] = i;
+	}
+	free(states[0].strokes);
+	free(states[1].strokes);
+	return unique_len;
+}
+
+// Grid and atlas sprite sheets hold each unique frame once, packed into shelves that are streamed out one at a time
+struct export_atlas {
+	struct atlas_rect* trims; // the part of each unique frame that is kept, all of it in grids
+	struct atlas_rect* rects; // where each sits in the sheet
+	uint32_t width;
+	uint32_t height;
+	bool measuring; // the first pass of a trimmed atlas, which only finds the bounds
+	uint8_t* band; // rows of the sheet from band_y down, until the shelf is complete
+	uint32_t band_y;
+};
+
+// Frames of one export, software exports hand out the unique ones in order to a pool of workers
+struct export_job {
+	const char* outdir;
+	struct png_file_stream* sheet; // frames are streamed into the sprite sheet, GIF or raw stream in order, image sequences write a file each
+	struct gif_file* gif;
+	struct frame_stream* stream;
+	struct export_atlas* atlas; // lays out the frames for `sheet`, and finds their bounds before it is opened
+	vec2 size;
+	vec2 framebuffer_size;
+	vec2 offset;
+	float frametime;
+	uint32_t frames;
+	uint32_t* unique; // frames that draw something new, the ones after each until the next repeat it
+	uint32_t unique_len;
+	uint32_t threads; // 0 uses every core
+	enum png_compression compression;
+	
+	pthread_mutex_t lock;
+	uint32_t next_frame;
+	bool failed;
+	struct lb_export_stats stats;
+	
+	// Software frames for the ordered outputs wait in a ring until the calling thread streams them out in order
+	uint8_t* ring;
+	bool* ring_ready;
+	uint32_t ring_len;
+	uint32_t written;
+	pthread_cond_t frame_ready;
+	pthread_cond_t slot_free;
+};
+
+// Frames a unique frame stands for, itself and the repeats after it
+static uint32_t export_hold_length(const struct export_job* job, uint32_t u) {
+	return (u+1 < job->unique_len ? job->unique[u+1] : job->frames) - job->unique[u];
+}
+
+static bool export_in_order(const struct export_job* job) {
+	return job->sheet || job->gif || job->stream || job->atlas;
+}
+
+// Streams the atlas rows above `y` into the sheet, clearing the band for the shelf starting there
+static void flush_atlas_band(struct export_job* job, uint32_t y) {
+	struct export_atlas* atlas = job->atlas;
+	const size_t row_bytes = (size_t)atlas->width * 4;
+	const uint32_t rows = y - atlas->band_y;
+	if(!rows) return;
+	png_file_stream_rows(job->sheet, atlas->band, rows, row_bytes);
+	memset(atlas->band, 0, row_bytes * rows);
+	atlas->band_y = y;
+}
+
+static bool write_atlas_frame(struct export_job* job, const uint8_t* pixels, uint32_t u) {
+	struct export_atlas* atlas = job->atlas;
+	const uint32_t frame_width = job->framebuffer_size.x, frame_height = job->framebuffer_size.y;
+	if(atlas->measuring) {
+		atlas->trims[u] = atlas_trim_bounds(pixels, frame_width, frame_height);
+		return true;
+	}
+	
+	const struct atlas_rect* trim = &atlas->trims[u];
+	const struct atlas_rect* rect = &atlas->rects[u];
+	if(!rect->width || !rect->height) return true;
+	if(rect->y != atlas->band_y) flush_atlas_band(job, rect->y); // frames are packed in order, so the shelf before is done
+	for(uint32_t row = 0; row < rect->height; row++) {
+		const uint8_t* from = pixels + ((size_t)(frame_height - 1 - trim->y - row) * frame_width + trim->x) * 4; // frames are bottom-up
+		uint8_t* to = atlas->band + ((size_t)row * atlas->width + rect->x) * 4;
+		memcpy(to, from, (size_t)rect->width * 4);
+	}
+	return true;
+}
+
+// Streams a unique frame into the sprite sheet or raw stream once per frame of its hold, into the GIF as one frame lasting the hold,
+// or once into a grid or atlas
+static bool write_ordered_frame(struct export_job* job, const uint8_t* pixels, uint32_t u) {
+	const size_t row_bytes = (size_t)job->framebuffer_size.x * 4;
+	const uint32_t height = job->framebuffer_size.y;
+	const uint8_t* top = pixels + row_bytes * (height-1); // frames are bottom-up
+	uint32_t hold = export_hold_length(job, u);
+	if(job->atlas) return write_atlas_frame(job, pixels, u);
+	if(job->stream) return frame_stream_write(job->stream, pixels, hold);
+	if(job->gif) {
+		// Delays are in hundredths of a second, rounding where each hold starts keeps them from drifting
+		uint32_t start = job->unique[u];
+		uint32_t delay = (uint32_t)lround((start + hold) * job->frametime * 100.0) - (uint32_t)lround(start * job->frametime * 100.0);
+		return gif_file_frame(job->gif, top, -(ptrdiff_t)row_bytes, delay);
+	}
+	for(; hold; hold--) png_file_stream_rows(job->sheet, top, height, -(ptrdiff_t)row_bytes);
+	return true;
 }
 
-void lb_strokes_render_strokes(const float time, const mat4 matrix, const vec2 pan) {
-	glEnable(GL_BLEND);
-	glBlendEquation(GL_FUNC_ADD);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+static void* export_worker(void* arg) {
+	struct export_job* job = arg;
+	const size_t frame_bytes = (size_t)job->framebuffer_size.x * (size_t)job->framebuffer_size.y * 4;
+	uint8_t* frame = export_in_order(job) ? NULL : malloc(frame_bytes);
+	assert(export_in_order(job) || frame);
 	
-	glDisable(GL_DEPTH_TEST);
+	// Frames are claimed in ascending order, so each worker's own timeline only moves forward
+	struct interval_sweep timeline = {0};
+	sweep_copy(&timeline, &data.timeline);
+	double render_seconds = 0;
+	struct encode_times times = {0};
 	
-	glUseProgram(brush_shader.program);
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	glUniform2f(brush_shader.uniforms[BRUSH_UNIFORM_PAN], pan.x, pan.y);
-	glUniformMatrix4fv(brush_shader.uniforms[BRUSH_UNIFORM_PROJECTION], 1, GL_FALSE, (const GLfloat*) matrix);
-	for(size_t i = 0; i < data.strokes_len; i++) {
-		if(data.strokes[i].vertices_len < 2) continue;
+	for(;;) {
+		pthread_mutex_lock(&job->lock);
+		uint32_t u = job->failed ? job->unique_len : job->next_frame;
+		if(u < job->unique_len) job->next_frame++;
+		pthread_mutex_unlock(&job->lock);
+		if(u >= job->unique_len) break;
+		uint32_t i = job->unique[u];
 		
-		enum draw_state state = lb_stroke_getDrawStateForTime(&data.strokes[i], time);
-		bool reverse = false;
-		
-		float percent_drawn;
-		enum lb_animate_method method;
-		switch(state) {
-			case NONE:
-				continue;
-			case FULL:
-				percent_drawn = 1;
-				break;
-			case ENTERING:
-				percent_drawn = EasingFuncs[data.strokes[i].enter.easing_method](map(
-					time,
-					data.strokes[i].global_start_time,
-					data.strokes[i].global_start_time + data.strokes[i].enter.duration,
-					0, 1));
-				reverse = data.strokes[i].enter.draw_reverse;
-				method = data.strokes[i].enter.animate_method;
-				break;
-			case EXITING: {
-				float begin = data.strokes[i].global_start_time +
-					(data.strokes[i].enter.animate_method == ANIMATE_NONE ? 0 : data.strokes[i].enter.duration) +
-					data.strokes[i].full_duration;
-				float end = begin + data.strokes[i].exit.duration;
-				percent_drawn = EasingFuncs[data.strokes[i].exit.easing_method](map(
-					time,
-					begin, end,
-					1, 0));
-				reverse = data.strokes[i].exit.draw_reverse;
-				method = data.strokes[i].exit.animate_method;
-				break;
-			}
+		uint8_t* pixels = frame;
+		if(export_in_order(job)) {
+			pthread_mutex_lock(&job->lock);
+			while(u >= job->written + job->ring_len && !job->failed) pthread_cond_wait(&job->slot_free, &job->lock);
+			bool failed = job->failed;
+			pthread_mutex_unlock(&job->lock);
+			if(failed) break;
+			pixels = job->ring + frame_bytes * (u % job->ring_len);
 		}
 		
-		size_t v;
-		int dir = reverse ? -1 : 1;
-		
-		float total_length = 0.0f;
-		for(size_t vi = 0; vi < data.strokes[i].vertices_len-1; vi++) {
-			v = reverse ? (data.strokes[i].vertices_len-1) - vi : vi;
-			
-			struct bezier_point* a = &data.strokes[i].vertices[v];
-			struct bezier_point* b = &data.strokes[i].vertices[v+dir];
-			vec2 h1, h2;
-			if(reverse) {
-				h1 = a->handles[0];
-				h2 = b->handles[1];
-			} else {
-				h1 = a->handles[1];
-				h2 = b->handles[0];
-			}
-			
-			total_length += bezier_distance_update_cache(a->anchor, h1, h2, b->anchor);
-		}
+		double begin = monotonic_seconds();
+		render_stroke_export_frame_software(&timeline, lb_strokes_export_range_begin + i * job->frametime, pixels, job->size, job->framebuffer_size, job->offset);
+		render_seconds += monotonic_seconds() - begin;
 		
-		if(method == ANIMATE_FADE) {
-			glUniform1f(brush_shader.uniforms[BRUSH_UNIFORM_ALPHA], percent_drawn);
-			percent_drawn = 1;
-		} else {
-			glUniform1f(brush_shader.uniforms[BRUSH_UNIFORM_ALPHA], 1);
+		if(export_in_order(job)) {
+			pthread_mutex_lock(&job->lock);
+			job->ring_ready[u % job->ring_len] = true;
+			pthread_cond_signal(&job->frame_ready);
+			pthread_mutex_unlock(&job->lock);
+		} else if(!frame_write_file(job->outdir, i, pixels, job->framebuffer_size.x, job->framebuffer_size.y, job->compression, &times)) {
+			pthread_mutex_lock(&job->lock);
+			job->failed = true;
+			pthread_mutex_unlock(&job->lock);
 		}
+	}
+	
+	pthread_mutex_lock(&job->lock);
+	job->stats.render_seconds += render_seconds;
+	job->stats.encode_seconds += times.encode_seconds;
+	job->stats.write_seconds += times.write_seconds;
+	pthread_mutex_unlock(&job->lock);
+	
+	sweep_destroy(&timeline);
+	free(frame);
+	return NULL;
+}
+
+// Streams rendered frames from the ring into the ordered output as they become ready, in order.
+// A failed write stops the workers waiting on a slot too.
+static void write_ordered_frames(struct export_job* job) {
+	const size_t frame_bytes = (size_t)job->framebuffer_size.x * (size_t)job->framebuffer_size.y * 4;
+	for(uint32_t u = 0; u < job->unique_len; u++) {
+		uint32_t slot = u % job->ring_len;
+		pthread_mutex_lock(&job->lock);
+		while(!job->ring_ready[slot]) pthread_cond_wait(&job->frame_ready, &job->lock);
+		pthread_mutex_unlock(&job->lock);
 		
-		glUniform4f(brush_shader.uniforms[BRUSH_UNIFORM_COLOR], data.strokes[i].color.r, data.strokes[i].color.g, data.strokes[i].color.b, data.strokes[i].color.a);
+		bool written = write_ordered_frame(job, job->ring + frame_bytes * slot, u);
 		
-		float total_length_drawn = total_length*percent_drawn;
-		//TODO: Optimize out the double calculation of length, cache the total length if possible
+		pthread_mutex_lock(&job->lock);
+		if(!written) {
+			job->failed = true;
+			pthread_cond_broadcast(&job->slot_free);
+			pthread_mutex_unlock(&job->lock);
+			return;
+		}
+		job->ring_ready[slot] = false;
+		job->written++;
+		pthread_cond_broadcast(&job->slot_free);
+		pthread_mutex_unlock(&job->lock);
+	}
+}
+
+// Renders and writes the ordered output one frame at a time on the calling thread, when no renderer could be started
+static void render_ordered_frames(struct export_job* job) {
+	struct interval_sweep timeline = {0};
+	sweep_copy(&timeline, &data.timeline);
+	for(uint32_t u = 0; u < job->unique_len; u++) {
+		double begin = monotonic_seconds();
+		render_stroke_export_frame_software(&timeline, lb_strokes_export_range_begin + job->unique[u] * job->frametime, job->ring, job->size, job->framebuffer_size, job->offset);
+		job->stats.render_seconds += monotonic_seconds() - begin;
 		
-		// Brush
+		if(!write_ordered_frame(job, job->ring, u)) {
+			job->failed = true;
+			break;
+		}
+	}
+	sweep_destroy(&timeline);
+}
+
+// Renders every frame of the job on the calling thread and up to threads-1 others.
+// Sprite sheets, GIFs and raw streams are rendered on `threads` others instead, the calling thread writing them out.
+static bool render_export_software(struct export_job* job) {
+	// The lazily built state the workers would otherwise race on is built up front
+	for(size_t i = 0; i < data.strokes_len; i++) {
+		if(data.hot[i].vertices_len >= 2) stroke_stamps(&data.strokes[i]);
+	}
+	uint32_t active_len;
+	sweep_advance(stroke_timeline(), lb_strokes_export_range_begin, &active_len);
+	
+	uint32_t threads = job->threads;
+	if(!threads) {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cores > 0 ? (uint32_t)cores : 1;
+	}
+	if(threads > job->unique_len) threads = job->unique_len ? job->unique_len : 1;
+	
+	pthread_mutex_init(&job->lock, NULL);
+	job->next_frame = 0;
+	job->failed = false;
+	if(export_in_order(job)) {
+		job->ring_len = threads * 2;
+		job->ring = malloc((size_t)job->framebuffer_size.x * (size_t)job->framebuffer_size.y * 4 * job->ring_len);
+		job->ring_ready = calloc(job->ring_len, sizeof(bool));
+		assert(job->ring && job->ring_ready);
+		job->written = 0;
+		pthread_cond_init(&job->frame_ready, NULL);
+		pthread_cond_init(&job->slot_free, NULL);
+	}
+	
+	pthread_t* workers = malloc(sizeof(pthread_t) * threads);
+	assert(workers);
+	uint32_t spawned = 0;
+	for(; spawned + (export_in_order(job) ? 0 : 1) < threads; spawned++) {
+		if(pthread_create(&workers[spawned], NULL, export_worker, job) != 0) break; // the remaining workers pick up the slack
+	}
+	uint32_t started = spawned;
+	if(!export_in_order(job)) {
+		export_worker(job);
+		started++;
+	} else if(spawned) {
+		write_ordered_frames(job);
+	} else {
+		render_ordered_frames(job);
+		started++;
+	}
+	for(uint32_t t = 0; t < spawned; t++) pthread_join(workers[t], NULL);
+	
+	if(export_in_order(job)) {
+		pthread_cond_destroy(&job->slot_free);
+		pthread_cond_destroy(&job->frame_ready);
+		free(job->ring_ready);
+		free(job->ring);
+	}
+	free(workers);
+	pthread_mutex_destroy(&job->lock);
+	job->stats.threads = started;
+	return !job->failed;
+}
+
+// Renders every frame of the job through the export framebuffer, keeping up to
+// EXPORT_READBACK_BUFFERS-1 frames in flight ahead of the one being copied out.
+// Image sequence frames are handed to a pool of encoder threads instead of being written here.
+static bool render_export_gl(struct export_job* job) {
+	const size_t row_bytes = (size_t)job->framebuffer_size.x * 4;
+	const size_t frame_bytes = row_bytes * (size_t)job->framebuffer_size.y;
+	struct frame_encoder* encoder = export_in_order(job) ? NULL : frame_encoder_init(job->outdir, job->framebuffer_size.x, job->framebuffer_size.y, job->compression, job->threads, 0);
+	uint8_t* ordered_frame = export_in_order(job) ? malloc(frame_bytes) : NULL;
+	assert(!export_in_order(job) || ordered_frame);
+	
+	glBindFramebuffer(GL_FRAMEBUFFER, export_fbo);
+	readback.format = preferred_readback_format();
+	glGenBuffers(EXPORT_READBACK_BUFFERS, readback.buffers);
+	for(uint32_t b = 0; b < EXPORT_READBACK_BUFFERS; b++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffers[b]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, frame_bytes, NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glCheckError();
+	
+	bool success = true;
+	uint32_t issued = 0;
+	for(uint32_t done = 0; done < job->unique_len; done++) {
+		double begin = monotonic_seconds();
+		for(; issued < job->unique_len && issued < done + EXPORT_READBACK_BUFFERS; issued++) {
+			render_stroke_export_frame(lb_strokes_export_range_begin + job->unique[issued] * job->frametime, issued % EXPORT_READBACK_BUFFERS, job->size, job->framebuffer_size, job->offset);
+		}
+		job->stats.render_seconds += monotonic_seconds() - begin;
 		
-		float length_accum = 0.0f;
-		for(size_t vi = 0; vi < data.strokes[i].vertices_len-1; vi++) {
-			v = reverse ? (data.strokes[i].vertices_len-1) - vi : vi;
-			
-			struct bezier_point* a = &data.strokes[i].vertices[v];
-			struct bezier_point* b = &data.strokes[i].vertices[v+dir];
-			vec2 h1, h2;
-			if(reverse) {
-				h1 = a->handles[0];
-				h2 = b->handles[1];
-			} else {
-				h1 = a->handles[1];
-				h2 = b->handles[0];
-			}
-			
-			
-			float segment_length = bezier_distance_update_cache(a->anchor, h1, h2, b->anchor);
-			float percent_segment_drawn = (total_length_drawn - length_accum) / segment_length;
-			if(percent_segment_drawn <= 0) break;
-			if(percent_segment_drawn > 1) percent_segment_drawn = 1;
-			
-			unsigned int total_equidistant_points_len = (unsigned int)ceil(segment_length / (data.strokes[i].scale / 2.0f));
-			unsigned int drawn_points_len = (unsigned int)ceil(percent_segment_drawn * total_equidistant_points_len) + 1;
-
-			//TODO: Instanced drawing
-			for(size_t p = 0; p < drawn_points_len; p++) {
-				vec2 loc = bezier_cubic(a->anchor, h1, h2, b->anchor, bezier_distance_closest_t(p/(float)total_equidistant_points_len));
-				glUniform1f(brush_shader.uniforms[BRUSH_UNIFORM_ROTATION], reverse ? (float)total_equidistant_points_len - (float)p : (float)p);
-				glUniform2f(brush_shader.uniforms[BRUSH_UNIFORM_TRANSLATION], loc.x, loc.y);
-				
-				float scale = data.strokes[i].scale;
-				if(data.strokes[i].jitter > 0) {
-					scale += scale * map(random_samples[(reverse ? total_equidistant_points_len-p : p) % RANDOM_SAMPLE_SIZE], 0, 1, -data.strokes[i].jitter, data.strokes[i].jitter);
-				}
-				glUniform2f(brush_shader.uniforms[BRUSH_UNIFORM_SCALE], scale, scale);
+		uint8_t* pixels = encoder ? frame_encoder_acquire(encoder) : ordered_frame;
+		if(!pixels) {
+			success = false;
+			break;
+		}
 		
-				glUniform1i(brush_shader.uniforms[BRUSH_UNIFORM_MASK_TEXTURE], 0);
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, mask_texture);
-				
-				glUniform1i(brush_shader.uniforms[BRUSH_UNIFORM_BRUSH_TEXTURE], 1);
-				glActiveTexture(GL_TEXTURE0+1);
-				glBindTexture(GL_TEXTURE_2D, brush_texture);
+		begin = monotonic_seconds();
+		if(!finish_export_readback(done % EXPORT_READBACK_BUFFERS, pixels, frame_bytes)) {
+			success = false;
+			break;
+		}
+		job->stats.render_seconds += monotonic_seconds() - begin;
+		if(encoder) {
+			frame_encoder_submit(encoder, pixels, job->unique[done]);
+			continue;
+		}
+		if(!write_ordered_frame(job, pixels, done)) {
+			success = false;
+			break;
+		}
+	}
+	free(ordered_frame);
+	
+	for(uint32_t b = 0; b < EXPORT_READBACK_BUFFERS; b++) {
+		if(readback.fences[b]) glDeleteSync(readback.fences[b]);
+		readback.fences[b] = 0;
+	}
+	glDeleteBuffers(EXPORT_READBACK_BUFFERS, readback.buffers);
+	
+	job->stats.threads = 1;
+	if(encoder) {
+		struct frame_encoder_stats encoder_stats;
+		if(!frame_encoder_finish(encoder, &encoder_stats)) success = false;
+		job->stats.threads = encoder_stats.threads;
+		job->stats.queue_depth = encoder_stats.depth;
+		job->stats.queue_high_water = encoder_stats.queued_high_water;
+		job->stats.stall_seconds = encoder_stats.stall_seconds;
+		job->stats.encode_seconds = encoder_stats.times.encode_seconds;
+		job->stats.write_seconds = encoder_stats.times.write_seconds;
+	}
+	return success;
+}
 
-				glBindVertexArray(plane_vao);
-				glDrawArrays(GL_TRIANGLES, 0, 6);
-			}
-			
-			length_accum += segment_length;
-			if(percent_segment_drawn < 1.0f) break;
+// Lists each hold, a unique frame and how many frames it lasts, for players that show it that long instead of repeating it
+static bool write_export_manifest(const char* path, const struct export_job* job, float fps, enum lb_export_type type) {
+	FILE* file = fopen(path, "w");
+	if(!file) {
+		fprintf(stderr, "Could not open output file %s\nError: %s\n", path, strerror(errno));
+		return false;
+	}
+	
+	fprintf(file, "{\n\t\"fps\": %.2f,\n\t\"frames\": %u,\n\t\"width\": %.0f,\n\t\"height\": %.0f,\n",
+		fps, job->frames, job->framebuffer_size.x, job->framebuffer_size.y);
+	if(job->atlas) fprintf(file, "\t\"sheet_width\": %u,\n\t\"sheet_height\": %u,\n", job->atlas->width, job->atlas->height);
+	fprintf(file, "\t\"holds\": [\n");
+	for(uint32_t u = 0; u < job->unique_len; u++) {
+		uint32_t frame = job->unique[u];
+		fprintf(file, "\t\t{\"frame\": %u, \"duration\": %u", frame, export_hold_length(job, u));
+		if(type == EXPORT_IMAGE_SEQUENCE) fprintf(file, ", \"file\": \"line_%04d.png\"", frame);
+		else if(job->atlas) {
+			// The frame's part of the sheet, drawn at the offset within the full frame
+			const struct atlas_rect* rect = &job->atlas->rects[u];
+			fprintf(file, ", \"x\": %u, \"y\": %u, \"width\": %u, \"height\": %u, \"offset_x\": %u, \"offset_y\": %u",
+				rect->x, rect->y, rect->width, rect->height, job->atlas->trims[u].x, job->atlas->trims[u].y);
 		}
+		else if(type == EXPORT_SPRITESHEET) fprintf(file, ", \"y\": %.0f", frame * job->framebuffer_size.y);
+		fprintf(file, u+1 < job->unique_len ? "},\n" : "}\n");
 	}
+	fprintf(file, "\t]\n}\n");
+	
+	if(fclose(file) != 0) {
+		fprintf(stderr, "Could not write output file %s\n", path);
+		return false;
+	}
+	return true;
 }
 
-static GLuint export_fbo;
-static GLuint export_rbo;
+// Steps an element through a grid or atlas, for <div id="drawing"><div></div></div>.
+// Each unique frame is a keyframe moving and sizing the inner element to its part of the sheet.
+static bool write_atlas_css(const char* path, const char* image, const struct export_job* job) {
+	FILE* file = fopen(path, "w");
+	if(!file) {
+		fprintf(stderr, "Could not open output file %s\nError: %s\n", path, strerror(errno));
+		return false;
+	}
+	
+	const float scale = job->framebuffer_size.x / job->size.x; // sheets are drawn at @2x for retina
+	fprintf(file, "/* <div id=\"drawing\"><div></div></div> */\n\n\
+#drawing {\n\
+	position: relative;\n\
+	overflow: hidden;\n\
+	width: %gpx;\n\
+	height: %gpx;\n\
+}\n\
+\n\
+#drawing > div {\n\
+	position: absolute;\n\
+	background-image: url(\"%s\");\n\
+	background-size: %gpx %gpx;\n\
+	animation: play %.2fs step-end infinite;\n\
+}\n\
+\n\
+@keyframes play {\n", job->size.x, job->size.y, image, job->atlas->width / scale, job->atlas->height / scale, lb_strokes_export_range_duration);
+	
+	for(uint32_t u = 0; u < job->unique_len; u++) {
+		const struct atlas_rect* rect = &job->atlas->rects[u];
+		const struct atlas_rect* trim = &job->atlas->trims[u];
+		float percent = job->unique[u] * job->frametime / lb_strokes_export_range_duration * 100;
+		const char* format = "\t%s { left: %gpx; top: %gpx; width: %gpx; height: %gpx; background-position: %gpx %gpx; }\n";
+		char at[32];
+		snprintf(at, sizeof(at), "%.4f%%", percent);
+		fprintf(file, format, at, trim->x / scale, trim->y / scale, rect->width / scale, rect->height / scale, 0.0f - rect->x / scale, 0.0f - rect->y / scale);
+		if(u+1 == job->unique_len) fprintf(file, format, "100%", trim->x / scale, trim->y / scale, rect->width / scale, rect->height / scale, 0.0f - rect->x / scale, 0.0f - rect->y / scale);
+	}
+	fprintf(file, "}\n");
+	
+	if(fclose(file) != 0) {
+		fprintf(stderr, "Could not write output file %s\n", path);
+		return false;
+	}
+	return true;
+}
 
-static void render_stroke_export_frame(const float time, uint8_t* data, vec2 size, vec2 framebuffer_size, vec2 offset) {
+// Grid and atlas sprite sheets. A trimmed atlas renders every unique frame once to find its bounds before packing,
+// then again to stream it into the sheet; the frames' offsets are always written alongside as JSON.
+static bool render_export_atlas(struct export_job* job, const char* path, float fps, struct lb_export_options options) {
+	const uint32_t frame_width = job->framebuffer_size.x, frame_height = job->framebuffer_size.y;
+	struct export_atlas atlas = {0};
+	atlas.trims = malloc(sizeof(struct atlas_rect) * (job->unique_len ? job->unique_len : 1));
+	atlas.rects = malloc(sizeof(struct atlas_rect) * (job->unique_len ? job->unique_len : 1));
+	assert(atlas.trims && atlas.rects);
+	job->atlas = &atlas;
 	
-	glBindFramebuffer(GL_FRAMEBUFFER, export_fbo);
-	glBindRenderbuffer(GL_RENDERBUFFER, export_rbo);
-	glClearColor(0,0,0,0);
-	glClear(GL_COLOR_BUFFER_BIT);
+	bool success = true;
+	if(options.spritesheet.layout == SHEET_LAYOUT_ATLAS) {
+		atlas.measuring = true;
+		success = options.software ? render_export_software(job) : render_export_gl(job);
+		atlas.measuring = false;
+		for(uint32_t u = 0; u < job->unique_len; u++) {
+			atlas.rects[u] = (struct atlas_rect){0, 0, atlas.trims[u].width, atlas.trims[u].height};
+		}
+		atlas_pack_shelves(atlas.rects, job->unique_len, &atlas.width, &atlas.height);
+	} else {
+		for(uint32_t u = 0; u < job->unique_len; u++) atlas.trims[u] = (struct atlas_rect){0, 0, frame_width, frame_height};
+		atlas_pack_grid(atlas.rects, job->unique_len, frame_width, frame_height, &atlas.width, &atlas.height);
+	}
 	
-	update_ortho(crop_ortho, offset.x, offset.x + size.x, offset.y + size.y, offset.y, 0, 1);
-	lb_strokes_render_strokes(time, crop_ortho, (vec2){0,0});
+	if(atlas.width > EXPORT_TEXTURE_LIMIT || atlas.height > EXPORT_TEXTURE_LIMIT) {
+		fprintf(stderr, "Warning: the %ux%u sprite sheet is over the %u pixel texture limit of many browsers and GPUs.\n", atlas.width, atlas.height, EXPORT_TEXTURE_LIMIT);
+	}
 	
-	glReadBuffer(GL_COLOR_ATTACHMENT0);
-	glReadPixels(0, 0, framebuffer_size.x, framebuffer_size.y, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	uint32_t band_rows = ATLAS_PADDING;
+	for(uint32_t u = 0; u < job->unique_len; u++) {
+		if(atlas.rects[u].height + ATLAS_PADDING > band_rows) band_rows = atlas.rects[u].height + ATLAS_PADDING;
+	}
+	atlas.band = calloc((size_t)atlas.width * band_rows, 4);
+	assert(atlas.band);
+	
+	struct png_file_stream sheet;
+	if(success && png_file_stream_begin(&sheet, path, atlas.width, atlas.height, options.compression, options.threads)) {
+		job->sheet = &sheet;
+		success = options.software ? render_export_software(job) : render_export_gl(job);
+		if(success) flush_atlas_band(job, atlas.height);
+		if(!png_file_stream_end(&sheet)) success = false;
+		job->stats.encode_seconds += sheet.times.encode_seconds;
+		job->stats.write_seconds += sheet.times.write_seconds;
+		job->sheet = NULL;
+	} else {
+		success = false;
+	}
+	
+	char out_file[4096];
+	if(success) {
+		snprintf(out_file, 4096, "%s.json", path);
+		success = write_export_manifest(out_file, job, fps, EXPORT_SPRITESHEET);
+	}
+	if(success && options.spritesheet.include_css) {
+		snprintf(out_file, 4096, "%s", path);
+		char css_out_file[4096];
+		snprintf(css_out_file, 4096, "%s.css", path);
+		success = write_atlas_css(css_out_file, basename(out_file), job);
+	}
+	
+	job->atlas = NULL;
+	free(atlas.band);
+	free(atlas.rects);
+	free(atlas.trims);
+	return success;
 }
 
-void lb_strokes_render_export(const char* outdir, const float fps, struct lb_export_options options) {
+bool lb_strokes_render_export(const char* outdir, const float fps, struct lb_export_options options) {
 	assert(lb_strokes_export_range_set);
 	const float frametime = 1 / fps;
 	const uint32_t frames = ceil(lb_strokes_export_range_duration / frametime);
@@ -518,50 +2040,96 @@ void lb_strokes_render_export(const char* outdir, const float fps, struct lb_exp
 		.y = lb_strokes_artboard[0].y < lb_strokes_artboard[1].y ? lb_strokes_artboard[0].y : lb_strokes_artboard[1].y
 	};
 	
-	glGenFramebuffers(1, &export_fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, export_fbo);
-	glGenRenderbuffers(1, &export_rbo);
-	glBindRenderbuffer(GL_RENDERBUFFER, export_rbo);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, (GLsizei)framebuffer_size.x, (GLsizei)framebuffer_size.y);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, export_rbo);
-	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-		fprintf(stderr, "Incomplete framebuffer.\n");
-		return;
+	// The software rasterizer needs no GL context at all
+	if(!options.software) {
+		glGenFramebuffers(1, &export_fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, export_fbo);
+		glGenRenderbuffers(1, &export_rbo);
+		glBindRenderbuffer(GL_RENDERBUFFER, export_rbo);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, (GLsizei)framebuffer_size.x, (GLsizei)framebuffer_size.y);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, export_rbo);
+		if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			fprintf(stderr, "Incomplete framebuffer.\n");
+			glDeleteRenderbuffers(1, &export_rbo);
+			glDeleteFramebuffers(1, &export_fbo);
+			return false;
+		}
+		glCheckError();
+		
+		glViewport(0, 0, (GLsizei)framebuffer_size.x, (GLsizei)framebuffer_size.y);
 	}
-	glCheckError();
-	
-	glViewport(0, 0, (GLsizei)framebuffer_size.x, (GLsizei)framebuffer_size.y);
 	
 	char out_file[4096]; // TODO: PATH_MAX
+	bool success = true;
+	double begin = monotonic_seconds();
+	
+	struct export_job job = {
+		.outdir = outdir,
+		.size = size,
+		.framebuffer_size = framebuffer_size,
+		.offset = offset,
+		.frametime = frametime,
+		.frames = frames,
+		.threads = options.threads,
+		.compression = options.compression
+	};
+	job.unique = malloc(sizeof(uint32_t) * (frames ? frames : 1));
+	assert(job.unique);
+	job.unique_len = find_unique_frames(frames, frametime, job.unique);
 	
 	switch(options.type) {
 		case EXPORT_IMAGE_SEQUENCE: {
-			uint8_t* data = malloc(framebuffer_size.x*framebuffer_size.y*4);
-			for(uint32_t i = 0; i < frames; i++) {
-				
-				render_stroke_export_frame(lb_strokes_export_range_begin + i * frametime, data, size, framebuffer_size, offset);
-				
-				snprintf(out_file, 4096, "%s/line_%04d.png", outdir, i);
-				stbi_flip_vertically_on_write(1);
-				stbi_write_png(out_file, framebuffer_size.x, framebuffer_size.y, 4, data, 0);
+			success = options.software ? render_export_software(&job) : render_export_gl(&job);
+			
+			// Held frames are copies of the file their hold starts with
+			struct encode_times times = {0};
+			for(uint32_t u = 0; u < job.unique_len && success; u++) {
+				uint32_t repeats = export_hold_length(&job, u) - 1;
+				if(repeats && !frame_repeat_file(outdir, job.unique[u], repeats, &times)) success = false;
+			}
+			job.stats.write_seconds += times.write_seconds;
+			
+			if(success && options.manifest) {
+				snprintf(out_file, 4096, "%s/manifest.json", outdir);
+				success = write_export_manifest(out_file, &job, fps, options.type);
 			}
-			free(data);
 			break;
 		}
 		case EXPORT_SPRITESHEET: {
-			uint8_t* data = malloc(frames*framebuffer_size.x*framebuffer_size.y*4);
-			uint8_t* cursor = data + (int)(frames*framebuffer_size.x*framebuffer_size.y*4) - (int)(framebuffer_size.x*framebuffer_size.y*4); // start at the end because they're flipped backwards
-			for(uint32_t i = 0; i < frames; i++) {
-				render_stroke_export_frame(lb_strokes_export_range_begin + i * frametime, cursor, size, framebuffer_size, offset);
-				cursor -= (int)(framebuffer_size.x*framebuffer_size.y*4);
+			if(options.spritesheet.layout != SHEET_LAYOUT_STRIP) {
+				success = render_export_atlas(&job, outdir, fps, options);
+				break;
+			}
+			
+			// Frames are stacked top to bottom, each streamed out as soon as it is rendered
+			uint64_t sheet_height = (uint64_t)framebuffer_size.y * frames;
+			if(!sheet_height || sheet_height > INT32_MAX) {
+				fprintf(stderr, "Sprite sheet of %u frames can not be %llu pixels tall.\n", frames, (unsigned long long)sheet_height);
+				success = false;
+				break;
+			}
+			if(sheet_height > EXPORT_TEXTURE_LIMIT) {
+				fprintf(stderr, "Warning: the %llu pixel tall sprite sheet is over the %u pixel texture limit of many browsers and GPUs, a grid or atlas layout would fit.\n",
+					(unsigned long long)sheet_height, EXPORT_TEXTURE_LIMIT);
 			}
 			
-			stbi_flip_vertically_on_write(1);
-			stbi_write_png(outdir, framebuffer_size.x, framebuffer_size.y*frames, 4, data, 0);
+			struct png_file_stream sheet;
+			if(!png_file_stream_begin(&sheet, outdir, framebuffer_size.x, (uint32_t)sheet_height, options.compression, options.threads)) {
+				success = false;
+				break;
+			}
+			job.sheet = &sheet;
+			success = options.software ? render_export_software(&job) : render_export_gl(&job);
+			if(!png_file_stream_end(&sheet)) success = false;
+			job.stats.encode_seconds += sheet.times.encode_seconds;
+			job.stats.write_seconds += sheet.times.write_seconds;
 			
-			free(data);
+			if(success && options.manifest) {
+				snprintf(out_file, 4096, "%s.json", outdir);
+				success = write_export_manifest(out_file, &job, fps, options.type);
+			}
 
-			if(options.spritesheet.include_css) {
+			if(success && options.spritesheet.include_css) {
 				strncpy(out_file, outdir, 4096);
 				char html_out_file[4096];
 				strncpy(html_out_file, out_file, 4096);
@@ -570,7 +2138,8 @@ void lb_strokes_render_export(const char* outdir, const float fps, struct lb_exp
 				FILE* file = fopen(html_out_file, "w");
 				if(!file) {
 					fprintf(stderr, "Could not open output file %s\nError: %s\n", html_out_file, strerror(errno));
-					return;
+					success = false;
+					break;
 				}
 				
 				fprintf(file, "<!DOCTYPE html>\n\
@@ -599,10 +2168,71 @@ void lb_strokes_render_export(const char* outdir, const float fps, struct lb_exp
 			
 			break;
 		}
+		case EXPORT_GIF: {
+			if(framebuffer_size.x > UINT16_MAX || framebuffer_size.y > UINT16_MAX) {
+				fprintf(stderr, "GIF frames can not be %.0fx%.0f pixels.\n", framebuffer_size.x, framebuffer_size.y);
+				success = false;
+				break;
+			}
+			
+			// The palette is made from the document's stroke colours, the frames flattened over the app's background
+			uint8_t (*colors)[3] = malloc(sizeof(uint8_t[3]) * (data.strokes_len ? data.strokes_len : 1));
+			assert(colors);
+			for(size_t i = 0; i < data.strokes_len; i++) {
+				const colorf color = data.strokes[i].color;
+				colors[i][0] = (uint8_t)lroundf(fminf(fmaxf(color.r, 0), 1) * 255);
+				colors[i][1] = (uint8_t)lroundf(fminf(fmaxf(color.g, 0), 1) * 255);
+				colors[i][2] = (uint8_t)lroundf(fminf(fmaxf(color.b, 0), 1) * 255);
+			}
+			const uint8_t background[3] = {lb_clear_color.r, lb_clear_color.g, lb_clear_color.b};
+			job.gif = gif_file_begin(outdir, framebuffer_size.x, framebuffer_size.y, (const uint8_t (*)[3])colors, data.strokes_len, background);
+			free(colors);
+			if(!job.gif) {
+				success = false;
+				break;
+			}
+			
+			success = options.software ? render_export_software(&job) : render_export_gl(&job);
+			struct encode_times times = {0};
+			if(!gif_file_end(job.gif, &times)) success = false;
+			job.stats.encode_seconds += times.encode_seconds;
+			job.stats.write_seconds += times.write_seconds;
+			
+			if(success && options.manifest) {
+				snprintf(out_file, 4096, "%s.json", outdir);
+				success = write_export_manifest(out_file, &job, fps, options.type);
+			}
+			break;
+		}
+		case EXPORT_RAW_STREAM: {
+			// Every frame is written, holds included, for encoders expecting a constant frame rate
+			struct frame_stream stream;
+			if(!frame_stream_begin(&stream, outdir, framebuffer_size.x, framebuffer_size.y, fps, options.raw_stream.y4m ? FRAME_STREAM_Y4M : FRAME_STREAM_RGBA)) {
+				success = false;
+				break;
+			}
+			job.stream = &stream;
+			success = options.software ? render_export_software(&job) : render_export_gl(&job);
+			if(!frame_stream_end(&stream)) success = false;
+			job.stats.encode_seconds += stream.times.encode_seconds;
+			job.stats.write_seconds += stream.times.write_seconds;
+			break;
+		}
 	}
 	
-	glDeleteRenderbuffers(1, &export_rbo);
-	glDeleteFramebuffers(1, &export_fbo);
+	if(!options.software) {
+		glDeleteRenderbuffers(1, &export_rbo);
+		glDeleteFramebuffers(1, &export_fbo);
+	}
+	
+	free(job.unique);
+	if(options.stats) {
+		job.stats.frames = frames;
+		job.stats.duplicate_frames = frames - job.unique_len;
+		job.stats.total_seconds = monotonic_seconds() - begin;
+		*options.stats = job.stats;
+	}
+	return success;
 }
 
 void lb_strokes_render_app() {
@@ -614,95 +2244,127 @@ void lb_strokes_render_app() {
 	update_ortho(screen_ortho, 0, windowWidth, windowHeight, 0, 0, 1);
 	lb_strokes_render_strokes(lb_strokes_timelinePosition, screen_ortho, lb_strokes_pan);
 
-	if(lb_strokes_selected && input_mode != INPUT_ARTBOARD && input_mode != INPUT_TRIM) {
-		// Draw lines
-		glUseProgram(line_shader.program);
-		glEnable(GL_PROGRAM_POINT_SIZE);
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-		glUniform2f(line_shader.uniforms[LINE_UNIFORM_PAN], lb_strokes_pan.x, lb_strokes_pan.y);
-		
-		glUniformMatrix4fv(line_shader.uniforms[LINE_UNIFORM_PROJECTION], 1, GL_FALSE, (const GLfloat*) screen_ortho);
-		glUniform3f(line_shader.uniforms[LINE_UNIFORM_COLOR], 1.0f, 0.0f, 0.0f);
-		glUniform1f(line_shader.uniforms[LINE_UNIFORM_POINT_SIZE], 5.0f * (framebufferWidth / windowWidth));
-
-		glBindVertexArray(gl_lines.vao);
-		glBindBuffer(GL_ARRAY_BUFFER, gl_lines.vbo);
+	// The whole overlay is built on the CPU and uploaded once, then drawn as ranges of it
+	overlay_buffer.len = 0;
+	
+	bool draw_selection = lb_strokes_selected && input_mode != INPUT_ARTBOARD && input_mode != INPUT_TRIM;
+	size_t lines_first = 0, lines_len = 0;
+	size_t points_first = 0, points_len = 0;
+	size_t selected_point = 0;
+	// -- Hovered stroke
+	bool draw_hover = hovered_stroke && hovered_stroke != lb_strokes_selected && input_mode == INPUT_SELECT && drag_mode == DRAG_NONE;
+	if(draw_hover) overlay_push_curves(hovered_stroke);
+	size_t hover_len = overlay_buffer.len;
+	
+	if(draw_selection) {
+		lines_first = overlay_buffer.len;
 		
 		// -- Curves
-		for(size_t v = 0; v < lb_strokes_selected->vertices_len-1; v++) {
-			struct bezier_point* a = &lb_strokes_selected->vertices[v];
-			struct bezier_point* b = &lb_strokes_selected->vertices[v+1];
-			float len = bezier_estimate_length(a->anchor, a->handles[1], b->handles[0], b->anchor);
-			uint16_t segments = hyperbola_min_segments(len);
-			float step = 1.0f / (float)segments;
-			size_t lines = 0;
-			for(float t = 0; t <= 1; t += step) {
-				vec2 loc = bezier_cubic(a->anchor, a->handles[1], b->handles[0], b->anchor, t);
-				glBufferSubData(GL_ARRAY_BUFFER, lines*sizeof(vec2), sizeof(vec2), &loc);
-				lines++;
-			}
-			glDrawArrays(GL_LINE_STRIP, 0, lines);
-		}
+		overlay_push_curves(lb_strokes_selected);
 		
 		// -- Handle lines
-		{
-			glUniform3f(line_shader.uniforms[LINE_UNIFORM_COLOR], 1.0f, 0.0f, 0.0f);
-			for(size_t v = 0; v < lb_strokes_selected->vertices_len; v++) {
-				glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vec2), &lb_strokes_selected->vertices[v].handles[0]);
-				glBufferSubData(GL_ARRAY_BUFFER, sizeof(vec2), sizeof(vec2), &lb_strokes_selected->vertices[v].anchor);
-				glBufferSubData(GL_ARRAY_BUFFER, sizeof(vec2)*2, sizeof(vec2), &lb_strokes_selected->vertices[v].handles[1]);
-				glDrawArrays(GL_LINE_STRIP, 0, 3);
-			}
+		for(size_t v = 0; v < stroke_hot(lb_strokes_selected)->vertices_len; v++) {
+			struct bezier_point* vertex = &stroke_vertices(lb_strokes_selected)[v];
+			overlay_push(vertex->handles[0]);
+			overlay_push(vertex->anchor);
+			overlay_push(vertex->anchor);
+			overlay_push(vertex->handles[1]);
 		}
+		lines_len = overlay_buffer.len - lines_first;
 		
 		// -- Control points
-		{
-			// Indicate the selected vertex
-			if(lb_strokes_selected_vertex) {
-				glUniform3f(line_shader.uniforms[LINE_UNIFORM_COLOR], 1.0f, 0.0f, 1.0f);
-				glUniform1f(line_shader.uniforms[LINE_UNIFORM_POINT_SIZE], 9.0f * (framebufferWidth / windowWidth));
-				glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vec2), &lb_strokes_selected_vertex->anchor);
-				glDrawArrays(GL_POINTS, 0, 1);
-			}
-			
-			glUniform3f(line_shader.uniforms[LINE_UNIFORM_COLOR], 1.0f, 0.0f, 0.0f);
-			glUniform1f(line_shader.uniforms[LINE_UNIFORM_POINT_SIZE], 5.0f * (framebufferWidth / windowWidth));
-
-			glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vec2) * 3 * lb_strokes_selected->vertices_len, lb_strokes_selected->vertices);
-			glDrawArrays(GL_POINTS, 0, 3 * lb_strokes_selected->vertices_len);
-
-			glUniform3f(line_shader.uniforms[LINE_UNIFORM_COLOR], 1.0f, 1.0f, 1.0f);
-			glUniform1f(line_shader.uniforms[LINE_UNIFORM_POINT_SIZE], 3.0f * (framebufferWidth / windowWidth));
-			
-			glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vec2) * 3 * lb_strokes_selected->vertices_len, lb_strokes_selected->vertices);
-			glDrawArrays(GL_POINTS, 0, 3 * lb_strokes_selected->vertices_len);
+		if(lb_strokes_selected_vertex) {
+			selected_point = overlay_buffer.len;
+			overlay_push(lb_strokes_selected_vertex->anchor);
 		}
-
-		glCheckError();
+		points_first = overlay_buffer.len;
+		for(size_t v = 0; v < stroke_hot(lb_strokes_selected)->vertices_len; v++) {
+			struct bezier_point* vertex = &stroke_vertices(lb_strokes_selected)[v];
+			overlay_push(vertex->anchor);
+			overlay_push(vertex->handles[0]);
+			overlay_push(vertex->handles[1]);
+		}
+		points_len = overlay_buffer.len - points_first;
+	}
+	
+	// -- Artboard box
+	bool draw_artboard = lb_strokes_artboard_set || lb_strokes_artboard_set_idx == 1;
+	size_t artboard_first = overlay_buffer.len;
+	if(draw_artboard) {
+		overlay_push(lb_strokes_artboard[0]);
+		overlay_push((vec2){lb_strokes_artboard[0].x, lb_strokes_artboard[1].y});
+		overlay_push(lb_strokes_artboard[1]);
+		overlay_push((vec2){lb_strokes_artboard[1].x, lb_strokes_artboard[0].y});
+		overlay_push(lb_strokes_artboard[0]);
+	}
+	
+	if(!overlay_buffer.len) return;
+	
+	glUseProgram(line_shader.program);
+	glEnable(GL_PROGRAM_POINT_SIZE);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+	glUniform2f(line_shader.uniforms[LINE_UNIFORM_PAN], lb_strokes_pan.x, lb_strokes_pan.y);
+	glUniformMatrix4fv(line_shader.uniforms[LINE_UNIFORM_PROJECTION], 1, GL_FALSE, (const GLfloat*) screen_ortho);
+	
+	// Respecifying the store orphans last frame's overlay instead of waiting on it
+	glBindVertexArray(gl_lines.vao);
+	glBindBuffer(GL_ARRAY_BUFFER, gl_lines.vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vec2) * overlay_buffer.len, overlay_buffer.vertices, GL_STREAM_DRAW);
+	
+	if(draw_hover) {
+		glUniform3f(line_shader.uniforms[LINE_UNIFORM_COLOR], 1.0f, 0.6f, 0.6f);
+		glDrawArrays(GL_LINES, 0, hover_len);
 	}
 	
-	// Artboard box
-	if(lb_strokes_artboard_set || lb_strokes_artboard_set_idx == 1) {
+	if(draw_selection) {
+		glUniform3f(line_shader.uniforms[LINE_UNIFORM_COLOR], 1.0f, 0.0f, 0.0f);
+		glDrawArrays(GL_LINES, lines_first, lines_len);
 		
-		glUseProgram(line_shader.program);
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-		glUniform2f(line_shader.uniforms[LINE_UNIFORM_PAN], lb_strokes_pan.x, lb_strokes_pan.y);
-		glUniformMatrix4fv(line_shader.uniforms[LINE_UNIFORM_PROJECTION], 1, GL_FALSE, (const GLfloat*) screen_ortho);
-
-		glBindVertexArray(gl_lines.vao);
-		glBindBuffer(GL_ARRAY_BUFFER, gl_lines.vbo);
+		// Indicate the selected vertex
+		if(lb_strokes_selected_vertex) {
+			glUniform3f(line_shader.uniforms[LINE_UNIFORM_COLOR], 1.0f, 0.0f, 1.0f);
+			glUniform1f(line_shader.uniforms[LINE_UNIFORM_POINT_SIZE], 9.0f * (framebufferWidth / windowWidth));
+			glDrawArrays(GL_POINTS, selected_point, 1);
+		}
 		
+		glUniform3f(line_shader.uniforms[LINE_UNIFORM_COLOR], 1.0f, 0.0f, 0.0f);
+		glUniform1f(line_shader.uniforms[LINE_UNIFORM_POINT_SIZE], 5.0f * (framebufferWidth / windowWidth));
+		glDrawArrays(GL_POINTS, points_first, points_len);
+		
+		glUniform3f(line_shader.uniforms[LINE_UNIFORM_COLOR], 1.0f, 1.0f, 1.0f);
+		glUniform1f(line_shader.uniforms[LINE_UNIFORM_POINT_SIZE], 3.0f * (framebufferWidth / windowWidth));
+		glDrawArrays(GL_POINTS, points_first, points_len);
+	}
+	
+	if(draw_artboard) {
 		glUniform3f(line_shader.uniforms[LINE_UNIFORM_COLOR], 0.75f, 0.75f, 0.75f);
-		vec2 corners[5];
-		corners[0] = lb_strokes_artboard[0];
-		corners[2] = lb_strokes_artboard[1];
-		corners[1] = (vec2){corners[0].x, corners[2].y};
-		corners[3] = (vec2){corners[2].x, corners[0].y};
-		corners[4] = lb_strokes_artboard[0];
+		glDrawArrays(GL_LINE_STRIP, artboard_first, 5);
+	}
+	
+	glCheckError();
+}
+
+// Nearest stroke within the selection tolerance, testing only the segments whose boxes are in reach
+static struct lb_stroke* pick_stroke(vec2 point, const struct lb_stroke* only) {
+	vec2 tolerance = {select_tolerance_dist, select_tolerance_dist};
+	size_t candidates_len;
+	const uint64_t* candidates = spatial_query(data.segments_index, vec2_sub(point, tolerance), vec2_add(point, tolerance), &candidates_len);
+	
+	struct lb_stroke* picked = NULL;
+	float picked_dist = select_tolerance_dist;
+	for(size_t i = 0; i < candidates_len; i++) {
+		struct lb_stroke* stroke = &data.strokes[SEGMENT_ID_STROKE(candidates[i])];
+		if(only && stroke != only) continue;
 		
-		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vec2)*5, corners);
-		glDrawArrays(GL_LINE_STRIP, 0, 5);
+		struct bezier_point* a = &stroke_vertices(stroke)[SEGMENT_ID_SEGMENT(candidates[i])];
+		struct bezier_point* b = a + 1;
+		float dist;
+		if(bezier_distance_within(a->anchor, a->handles[1], b->handles[0], b->anchor, point, picked_dist, &dist)) {
+			picked = stroke;
+			picked_dist = dist;
+		}
 	}
+	return picked;
 }
 
 void lb_strokes_handleMouseDown(int button, vec2 point, float time) {
@@ -712,39 +2374,29 @@ void lb_strokes_handleMouseDown(int button, vec2 point, float time) {
 			switch(input_mode) {
 				case INPUT_SELECT: {
 					if(!lb_strokes_selected) {
-						for(size_t i = 0; i < data.strokes_len; i++) {
-							for(size_t v = 0; v < data.strokes[i].vertices_len-1; v++) {
-								struct bezier_point* a = &data.strokes[i].vertices[v];
-								struct bezier_point* b = &data.strokes[i].vertices[v+1];
-								vec2 closest = bezier_closest_point(a->anchor, a->handles[1], b->handles[0], b->anchor, 20, 3, point);
-								if(vec2_dist(point, closest) <= select_tolerance_dist) {
-									lb_strokes_selected = &data.strokes[i];
-									lb_strokes_selected_vertex = NULL;
-									goto exit;
-								}
-							}
-						}
-						
+						lb_strokes_selected = pick_stroke(point, NULL);
+						lb_strokes_selected_vertex = NULL;
 						goto exit;
 					}
 					
 					// Check all control points
-					for(size_t i = 0; i < lb_strokes_selected->vertices_len; i++) {
-						if(vec2_dist(point, lb_strokes_selected->vertices[i].anchor) <= select_tolerance_dist) {
+					struct bezier_point* vertices = stroke_vertices(lb_strokes_selected);
+					for(size_t i = 0; i < stroke_hot(lb_strokes_selected)->vertices_len; i++) {
+						if(vec2_dist(point, vertices[i].anchor) <= select_tolerance_dist) {
 							drag_mode = DRAG_ANCHOR;
-							drag_vec = &lb_strokes_selected->vertices[i].anchor;
-							lb_strokes_selected_vertex = &lb_strokes_selected->vertices[i];
+							drag_vec = &vertices[i].anchor;
+							lb_strokes_selected_vertex = &vertices[i];
 							break;
-						} else if(vec2_dist(point, lb_strokes_selected->vertices[i].handles[0]) <= select_tolerance_dist) {
+						} else if(vec2_dist(point, vertices[i].handles[0]) <= select_tolerance_dist) {
 							drag_mode = DRAG_HANDLE;
-							drag_vec = &lb_strokes_selected->vertices[i].handles[0];
-							lb_strokes_selected_vertex = &lb_strokes_selected->vertices[i];
+							drag_vec = &vertices[i].handles[0];
+							lb_strokes_selected_vertex = &vertices[i];
 							drag_handle_idx = 0;
 							break;
-						} else if(vec2_dist(point, lb_strokes_selected->vertices[i].handles[1]) <= select_tolerance_dist) {
+						} else if(vec2_dist(point, vertices[i].handles[1]) <= select_tolerance_dist) {
 							drag_mode = DRAG_HANDLE;
-							drag_vec = &lb_strokes_selected->vertices[i].handles[1];
-							lb_strokes_selected_vertex = &lb_strokes_selected->vertices[i];
+							drag_vec = &vertices[i].handles[1];
+							lb_strokes_selected_vertex = &vertices[i];
 							drag_handle_idx = 1;
 							break;
 						}
@@ -752,15 +2404,10 @@ void lb_strokes_handleMouseDown(int button, vec2 point, float time) {
 					if(drag_mode != DRAG_NONE) break;
 					
 					// Check the stroke itself
-					for(size_t v = 0; v < lb_strokes_selected->vertices_len-1; v++) {
-						struct bezier_point* a = &lb_strokes_selected->vertices[v];
-						struct bezier_point* b = &lb_strokes_selected->vertices[v+1];
-						vec2 closest = bezier_closest_point(a->anchor, a->handles[1], b->handles[0], b->anchor, 20, 3, point);
-						if(vec2_dist(point, closest) <= select_tolerance_dist) {
-							drag_start = point;
-							drag_mode = DRAG_STROKE;
-							goto exit;
-						}
+					if(pick_stroke(point, lb_strokes_selected)) {
+						drag_start = point;
+						drag_mode = DRAG_STROKE;
+						goto exit;
 					}
 					lb_strokes_selected = NULL; // not close enough to any points, so must be a deselect
 					lb_strokes_selected_vertex = NULL;
@@ -787,9 +2434,6 @@ void lb_strokes_handleMouseDown(int button, vec2 point, float time) {
 
 				case INPUT_DRAW: {
 					if(!lb_strokes_selected) {
-						// Prevent exceeding maximum strokes
-						if(data.strokes_len >= MAX_STROKES) return;
-						
 						lb_strokes_selected = create_stroke();
 						lb_strokes_selected->global_start_time = lb_strokes_timelinePosition - 0.35f;
 						lb_strokes_selected->full_duration = 1.0f;
@@ -808,13 +2452,14 @@ void lb_strokes_handleMouseDown(int button, vec2 point, float time) {
 						};
 					}
 					
-					// Prevent exceeding maximum vertices
-					if(lb_strokes_selected->vertices_len >= MAX_STROKE_VERTICES) return;
+					// The .line format counts a stroke's vertices in 16 bits
+					if(stroke_hot(lb_strokes_selected)->vertices_len >= UINT16_MAX) return;
 					
 					struct bezier_point* vert = add_vertex(lb_strokes_selected);
 					vert->anchor = point;
 					vert->handles[0] = (vec2){point.x, point.y};
 					vert->handles[1] = (vec2){point.x, point.y};
+					index_vertex(lb_strokes_selected, vert);
 
 					// Enable dragging of handle
 					drag_mode = DRAG_HANDLE;
@@ -878,6 +2523,7 @@ void lb_strokes_handleMouseMove(vec2 point, float time) {
 	
 	switch(drag_mode) {
 		case DRAG_NONE:
+			if(input_mode == INPUT_SELECT) hovered_stroke = pick_stroke(vec2_sub(point, lb_strokes_pan), NULL);
 			return;
 		case DRAG_ANCHOR: {
 			assert(lb_strokes_selected_vertex);
@@ -886,27 +2532,36 @@ void lb_strokes_handleMouseMove(vec2 point, float time) {
 			*drag_vec = vec2_sub(point, lb_strokes_pan);
 			lb_strokes_selected_vertex->handles[0] = vec2_add(lb_strokes_selected_vertex->handles[0], diff);
 			lb_strokes_selected_vertex->handles[1] = vec2_add(lb_strokes_selected_vertex->handles[1], diff);
+			invalidate_vertex(lb_strokes_selected, lb_strokes_selected_vertex);
+			index_vertex(lb_strokes_selected, lb_strokes_selected_vertex);
 			break;
 		}
 		case DRAG_HANDLE: {
 			assert(lb_strokes_selected_vertex);			
 			*drag_vec = vec2_sub(point, lb_strokes_pan);
-			if(mods_pressed[MOD_ALT]) break;
-			
-			// mirror the other point
-			lb_strokes_selected_vertex->handles[drag_handle_idx ? 0 : 1].x = 2*lb_strokes_selected_vertex->anchor.x - drag_vec->x;
-			lb_strokes_selected_vertex->handles[drag_handle_idx ? 0 : 1].y = 2*lb_strokes_selected_vertex->anchor.y - drag_vec->y;
+			invalidate_vertex(lb_strokes_selected, lb_strokes_selected_vertex);
+			if(!mods_pressed[MOD_ALT]) {
+				// mirror the other point
+				lb_strokes_selected_vertex->handles[drag_handle_idx ? 0 : 1].x = 2*lb_strokes_selected_vertex->anchor.x - drag_vec->x;
+				lb_strokes_selected_vertex->handles[drag_handle_idx ? 0 : 1].y = 2*lb_strokes_selected_vertex->anchor.y - drag_vec->y;
+			}
+			index_vertex(lb_strokes_selected, lb_strokes_selected_vertex);
 			break;
 		}
 		case DRAG_STROKE: {
 			assert(lb_strokes_selected);
 			vec2 diff = vec2_sub(vec2_sub(point, lb_strokes_pan), drag_start);
 			drag_start = vec2_add(drag_start, diff);
-			for(size_t i = 0; i < lb_strokes_selected->vertices_len; i++) {
-				lb_strokes_selected->vertices[i].anchor = vec2_add(lb_strokes_selected->vertices[i].anchor, diff);
-				lb_strokes_selected->vertices[i].handles[0] = vec2_add(lb_strokes_selected->vertices[i].handles[0], diff);
-				lb_strokes_selected->vertices[i].handles[1] = vec2_add(lb_strokes_selected->vertices[i].handles[1], diff);
+			struct stroke_hot* hot = stroke_hot(lb_strokes_selected);
+			struct bezier_point* vertices = stroke_vertices(lb_strokes_selected);
+			for(size_t i = 0; i < hot->vertices_len; i++) {
+				vertices[i].anchor = vec2_add(vertices[i].anchor, diff);
+				vertices[i].handles[0] = vec2_add(vertices[i].handles[0], diff);
+				vertices[i].handles[1] = vec2_add(vertices[i].handles[1], diff);
 			}
+			hot->stamps.valid = false; // translation leaves the arc lengths intact
+			hot->curves.records_valid = false;
+			index_stroke(lb_strokes_selected);
 			break;
 		}
 		case DRAG_PAN: {
@@ -949,7 +2604,7 @@ void lb_strokes_handleKeyDown(int key, int scancode, int mods) {
 			if(lb_strokes_selected && lb_strokes_selected_vertex) {
 				delete_vertex(lb_strokes_selected, lb_strokes_selected_vertex);
 				lb_strokes_selected_vertex = NULL;
-				if(lb_strokes_selected->vertices_len <= 1) delete_stroke(lb_strokes_selected), lb_strokes_selected = NULL;
+				if(stroke_hot(lb_strokes_selected)->vertices_len <= 1) delete_stroke(lb_strokes_selected), lb_strokes_selected = NULL;
 			} else if(lb_strokes_selected) {
 				delete_stroke(lb_strokes_selected);
 				lb_strokes_selected = NULL;
@@ -990,6 +2645,53 @@ void lb_strokes_handleKeyUp(int key, int scancode, int mods) {
 	}
 }
 
+// Version 1 of the .line format: this header, a table of fixed-size stroke records and one blob of every
+// stroke's vertices, all naturally aligned so a document is read in a few large reads. The sizes and offsets
+// let later versions grow the header and records without breaking readers of this one.
+#define LINE_VERSION 1
+
+struct line_header {
+	char magic[4]; // LINE
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t stroke_size;
+	uint32_t strokes_offset;
+	uint32_t strokes_len;
+	uint32_t vertices_offset;
+	uint32_t vertices_len;
+	float timeline_duration;
+	float export_range_begin;
+	float export_range_duration;
+	float export_fps;
+	vec2 artboard[2];
+	uint8_t artboard_set;
+	uint8_t export_range_set;
+	uint8_t padding[2];
+};
+
+struct line_stroke {
+	float global_start_time;
+	float full_duration;
+	float scale;
+	float jitter;
+	colorf color;
+	uint32_t enter_animate_method;
+	uint32_t enter_easing_method;
+	float enter_duration;
+	uint32_t exit_animate_method;
+	uint32_t exit_easing_method;
+	float exit_duration;
+	uint32_t vertices_first; // the stroke's range of the vertex blob, which the ranges fill in order
+	uint32_t vertices_len;
+	uint8_t enter_draw_reverse;
+	uint8_t exit_draw_reverse;
+	uint8_t padding[2];
+};
+
+_Static_assert(sizeof(struct line_header) == 68, "line_header must match the file layout");
+_Static_assert(sizeof(struct line_stroke) == 68, "line_stroke must match the file layout");
+_Static_assert(sizeof(struct bezier_point) == 24, "bezier_point must match the file layout");
+
 void lb_strokes_save(const char* filename) {
 	FILE* file = fopen(filename, "wb");
 	if(!file) {
@@ -997,104 +2699,216 @@ void lb_strokes_save(const char* filename) {
 		return;
 	}
 	
-	static const unsigned int version = 0;
-	fwrite("LINE", 1, 4, file);
-	fwrite(&version, 4, 1, file);
-	fwrite(&lb_strokes_timelineDuration, 4, 1, file);
-	fwrite(&lb_strokes_artboard_set, 1, 1, file);
-	fwrite(&lb_strokes_artboard, 8, 2, file);
-	fwrite(&lb_strokes_export_range_set, 1, 1, file);
-	fwrite(&lb_strokes_export_range_begin, 4, 1, file);
-	fwrite(&lb_strokes_export_range_duration, 4, 1, file);
-	fwrite(&lb_strokes_export_fps, 4, 1, file);
-	fwrite(&data.strokes_len, 4, 1, file);
+	struct line_stroke* strokes = calloc(data.strokes_len ? data.strokes_len : 1, sizeof(struct line_stroke));
+	assert(strokes);
+	uint32_t vertices_len = 0;
 	for(size_t i = 0; i < data.strokes_len; i++) {
-		fwrite(&data.strokes[i].global_start_time, 4, 1, file);
-		fwrite(&data.strokes[i].full_duration, 4, 1, file);
-		fwrite(&data.strokes[i].scale, 4, 1, file);
-		fwrite(&data.strokes[i].color, 4, 4, file);
-		fwrite(&data.strokes[i].jitter, 4, 1, file);
+		const struct lb_stroke* stroke = &data.strokes[i];
+		strokes[i] = (struct line_stroke){
+			.global_start_time = stroke->global_start_time,
+			.full_duration = stroke->full_duration,
+			.scale = stroke->scale,
+			.jitter = stroke->jitter,
+			.color = stroke->color,
+			.enter_animate_method = stroke->enter.animate_method,
+			.enter_easing_method = stroke->enter.easing_method,
+			.enter_duration = stroke->enter.duration,
+			.exit_animate_method = stroke->exit.animate_method,
+			.exit_easing_method = stroke->exit.easing_method,
+			.exit_duration = stroke->exit.duration,
+			.vertices_first = vertices_len,
+			.vertices_len = data.hot[i].vertices_len,
+			.enter_draw_reverse = stroke->enter.draw_reverse,
+			.exit_draw_reverse = stroke->exit.draw_reverse
+		};
+		vertices_len += data.hot[i].vertices_len;
+	}
+	
+	struct line_header header = {
+		.magic = {'L', 'I', 'N', 'E'},
+		.version = LINE_VERSION,
+		.header_size = sizeof(struct line_header),
+		.stroke_size = sizeof(struct line_stroke),
+		.strokes_offset = sizeof(struct line_header),
+		.strokes_len = data.strokes_len,
+		.vertices_offset = sizeof(struct line_header) + sizeof(struct line_stroke) * data.strokes_len,
+		.vertices_len = vertices_len,
+		.timeline_duration = lb_strokes_timelineDuration,
+		.export_range_begin = lb_strokes_export_range_begin,
+		.export_range_duration = lb_strokes_export_range_duration,
+		.export_fps = lb_strokes_export_fps,
+		.artboard = {lb_strokes_artboard[0], lb_strokes_artboard[1]},
+		.artboard_set = lb_strokes_artboard_set,
+		.export_range_set = lb_strokes_export_range_set
+	};
+	
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+	if(data.strokes_len) written = written && fwrite(strokes, sizeof(struct line_stroke), data.strokes_len, file) == data.strokes_len;
+	for(size_t i = 0; i < data.strokes_len && written; i++) {
+		const struct stroke_hot* hot = &data.hot[i];
+		if(hot->vertices_len) written = fwrite(&data.vertices[hot->vertices_first], sizeof(struct bezier_point), hot->vertices_len, file) == hot->vertices_len;
+	}
+	free(strokes);
+	
+	if(fclose(file) != 0 || !written) fprintf(stderr, "Could not write output file %s\n", filename);
+}
+
+// Methods are read from the file and later index EasingFuncs, so anything out of range is rejected
+static bool valid_transition(uint32_t animate_method, uint32_t easing_method) {
+	return animate_method <= ANIMATE_FADE && easing_method < EasingFuncsCount;
+}
+
+// Version 0 wrote each field on its own, with unaligned bools among them
+static bool read_line_v0(FILE* file) {
+	fread(&lb_strokes_timelineDuration, 4, 1, file);
+	fread(&lb_strokes_artboard_set, 1, 1, file);
+	fread(&lb_strokes_artboard, 8, 2, file);
+	fread(&lb_strokes_export_range_set, 1, 1, file);
+	fread(&lb_strokes_export_range_begin, 4, 1, file);
+	fread(&lb_strokes_export_range_duration, 4, 1, file);
+	fread(&lb_strokes_export_fps, 4, 1, file);
+	uint32_t strokes_len;
+	fread(&strokes_len, 4, 1, file);
+	
+	for(size_t i = 0; i < strokes_len; i++) {
+		struct lb_stroke* stroke = create_stroke();
+		fread(&stroke->global_start_time, 4, 1, file);
+		fread(&stroke->full_duration, 4, 1, file);
+		fread(&stroke->scale, 4, 1, file);
+		fread(&stroke->color, 4, 4, file);
+		fread(&stroke->jitter, 4, 1, file);
 		
-		fwrite(&data.strokes[i].enter.animate_method, 4, 1, file);
-		fwrite(&data.strokes[i].enter.easing_method, 4, 1, file);
-		fwrite(&data.strokes[i].enter.duration, 4, 1, file);
-		fwrite(&data.strokes[i].enter.draw_reverse, 1, 1, file);
+		fread(&stroke->enter.animate_method, 4, 1, file);
+		fread(&stroke->enter.easing_method, 4, 1, file);
+		fread(&stroke->enter.duration, 4, 1, file);
+		fread(&stroke->enter.draw_reverse, 1, 1, file);
 		
-		fwrite(&data.strokes[i].exit.animate_method, 4, 1, file);
-		fwrite(&data.strokes[i].exit.easing_method, 4, 1, file);
-		fwrite(&data.strokes[i].exit.duration, 4, 1, file);
-		fwrite(&data.strokes[i].exit.draw_reverse, 1, 1, file);
+		fread(&stroke->exit.animate_method, 4, 1, file);
+		fread(&stroke->exit.easing_method, 4, 1, file);
+		fread(&stroke->exit.duration, 4, 1, file);
+		fread(&stroke->exit.draw_reverse, 1, 1, file);
 		
-		fwrite(&data.strokes[i].vertices_len, 2, 1, file);
-		for(size_t v = 0; v < data.strokes[i].vertices_len; v++) {
-			fwrite(&data.strokes[i].vertices[v], 8, 3, file);
-		}
+		if(!valid_transition(stroke->enter.animate_method, stroke->enter.easing_method)) return false;
+		if(!valid_transition(stroke->exit.animate_method, stroke->exit.easing_method)) return false;
+		
+		uint16_t vertices_len;
+		if(fread(&vertices_len, 2, 1, file) != 1) return false;
+		reserve_stroke_vertices(stroke, vertices_len);
+		if(fread(stroke_vertices(stroke), sizeof(struct bezier_point), vertices_len, file) != vertices_len) return false;
+		stroke_hot(stroke)->vertices_len = vertices_len;
+		invalidate_stroke(stroke);
+		index_stroke(stroke);
 	}
+	return true;
+}
+
+// Reads the stroke table and the vertex blob whole, the blob straight into the packed vertex storage
+static bool read_line_v1(FILE* file) {
+	struct line_header header;
+	const size_t prefix = offsetof(struct line_header, header_size); // the magic and version were read to get here
+	if(fread((char*)&header + prefix, sizeof(header) - prefix, 1, file) != 1) return false;
+	if(header.header_size < sizeof(struct line_header) || header.stroke_size < sizeof(struct line_stroke)) return false;
 	
-	fclose(file);
+	fseek(file, 0, SEEK_END);
+	const uint64_t file_size = ftell(file);
+	if(header.header_size > file_size || header.stroke_size > file_size) return false; // even with no strokes, a record is allocated
+	if((uint64_t)header.strokes_offset + (uint64_t)header.strokes_len * header.stroke_size > file_size) return false;
+	if((uint64_t)header.vertices_offset + (uint64_t)header.vertices_len * sizeof(struct bezier_point) > file_size) return false;
+	
+	lb_strokes_timelineDuration = header.timeline_duration;
+	lb_strokes_artboard_set = header.artboard_set;
+	lb_strokes_artboard[0] = header.artboard[0];
+	lb_strokes_artboard[1] = header.artboard[1];
+	lb_strokes_export_range_set = header.export_range_set;
+	lb_strokes_export_range_begin = header.export_range_begin;
+	lb_strokes_export_range_duration = header.export_range_duration;
+	lb_strokes_export_fps = header.export_fps;
+	
+	uint8_t* records = malloc((size_t)header.stroke_size * (header.strokes_len ? header.strokes_len : 1));
+	assert(records);
+	fseek(file, header.strokes_offset, SEEK_SET);
+	if(header.strokes_len && fread(records, header.stroke_size, header.strokes_len, file) != header.strokes_len) {
+		free(records);
+		return false;
+	}
+	
+	reserve_strokes(header.strokes_len);
+	reserve_vertices(header.vertices_len);
+	const uint32_t vertices_base = data.vertices_len;
+	fseek(file, header.vertices_offset, SEEK_SET);
+	if(header.vertices_len && fread(&data.vertices[vertices_base], sizeof(struct bezier_point), header.vertices_len, file) != header.vertices_len) {
+		free(records);
+		return false;
+	}
+	
+	bool valid = true;
+	uint32_t vertices_next = 0;
+	for(uint32_t i = 0; i < header.strokes_len && valid; i++) {
+		struct line_stroke record;
+		memcpy(&record, records + (size_t)header.stroke_size * i, sizeof(record)); // later versions may append fields
+		valid = record.vertices_first == vertices_next && record.vertices_len <= UINT16_MAX && record.vertices_len <= header.vertices_len - vertices_next &&
+			valid_transition(record.enter_animate_method, record.enter_easing_method) &&
+			valid_transition(record.exit_animate_method, record.exit_easing_method);
+		if(!valid) break;
+		vertices_next += record.vertices_len;
+		
+		struct lb_stroke* stroke = create_stroke();
+		*stroke = (struct lb_stroke){
+			.global_start_time = record.global_start_time,
+			.full_duration = record.full_duration,
+			.scale = record.scale,
+			.jitter = record.jitter,
+			.color = record.color,
+			.enter = {record.enter_animate_method, record.enter_easing_method, record.enter_duration, record.enter_draw_reverse},
+			.exit = {record.exit_animate_method, record.exit_easing_method, record.exit_duration, record.exit_draw_reverse}
+		};
+		
+		// Each range is already in place, packed one after another
+		struct stroke_hot* hot = stroke_hot(stroke);
+		hot->vertices_first = vertices_base + record.vertices_first;
+		hot->vertices_cap = record.vertices_len;
+		hot->vertices_len = record.vertices_len;
+		data.vertices_len += record.vertices_len;
+		invalidate_stroke(stroke);
+		index_stroke(stroke);
+	}
+	free(records);
+	return valid && vertices_next == header.vertices_len; // the ranges must use the whole blob
 }
 
-void lb_strokes_open(const char* filename) {
+bool lb_strokes_open(const char* filename) {
 	FILE* file = fopen(filename, "rb");
 	if(!file) {
 		fprintf(stderr, "Could not open file %s\n", filename);
-		return;
+		return false;
 	}
 	
 	// Reset current state
+	for(size_t i = 0; i < data.strokes_len; i++) free_stamps(&data.hot[i].stamps);
 	data.strokes_len = 0;
-	pool_reset(data.vertices_pool);
+	data.vertices_len = 0;
+	data.vertices_holes = 0;
+	spatial_reset(data.segments_index);
+	data.timeline_dirty = true;
+	hovered_stroke = NULL;
 	lb_strokes_selected_vertex = NULL;
 	lb_strokes_selected = NULL;
 	lb_strokes_pan = (vec2){0,0};
 	
 	char buf[4];
-	fread(buf, 1, 4, file);
-	if(strncmp(buf, "LINE", 4) != 0) {
-		goto error;
-	}
-	
 	unsigned int version;
-	fread(&version, 4, 1, file);
-	
-	fread(&lb_strokes_timelineDuration, 4, 1, file);
-	fread(&lb_strokes_artboard_set, 1, 1, file);
-	fread(&lb_strokes_artboard, 8, 2, file);
-	fread(&lb_strokes_export_range_set, 1, 1, file);
-	fread(&lb_strokes_export_range_begin, 4, 1, file);
-	fread(&lb_strokes_export_range_duration, 4, 1, file);
-	fread(&lb_strokes_export_fps, 4, 1, file);
-	fread(&data.strokes_len, 4, 1, file);
-
-	for(size_t i = 0; i < data.strokes_len; i++) {
-		fread(&data.strokes[i].global_start_time, 4, 1, file);
-		fread(&data.strokes[i].full_duration, 4, 1, file);
-		fread(&data.strokes[i].scale, 4, 1, file);
-		fread(&data.strokes[i].color, 4, 4, file);
-		fread(&data.strokes[i].jitter, 4, 1, file);
-		
-		fread(&data.strokes[i].enter.animate_method, 4, 1, file);
-		fread(&data.strokes[i].enter.easing_method, 4, 1, file);
-		fread(&data.strokes[i].enter.duration, 4, 1, file);
-		fread(&data.strokes[i].enter.draw_reverse, 1, 1, file);
-		
-		fread(&data.strokes[i].exit.animate_method, 4, 1, file);
-		fread(&data.strokes[i].exit.easing_method, 4, 1, file);
-		fread(&data.strokes[i].exit.duration, 4, 1, file);
-		fread(&data.strokes[i].exit.draw_reverse, 1, 1, file);
-		
-		fread(&data.strokes[i].vertices_len, 2, 1, file);
-		data.strokes[i].vertices = pool_alloc(data.vertices_pool);
-		for(size_t v = 0; v < data.strokes[i].vertices_len; v++) {
-			fread(&data.strokes[i].vertices[v], 8, 3, file);
+	bool loaded = fread(buf, 1, 4, file) == 4 && strncmp(buf, "LINE", 4) == 0 && fread(&version, 4, 1, file) == 1;
+	if(loaded) {
+		switch(version) {
+			case 0: loaded = read_line_v0(file); break;
+			case 1: loaded = read_line_v1(file); break;
+			default:
+				fprintf(stderr, "Unsupported .line version %u.\n", version);
+				loaded = false;
 		}
 	}
-	
 	fclose(file);
-	return;
 	
-	error:
-		fclose(file);
-		fprintf(stderr, "Invalid or corrupt file format.\n");
-		return;
+	if(!loaded) fprintf(stderr, "Invalid or corrupt file format.\n");
+	return loaded;
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include "util.h"
 #include "easing.h"
+#include "pool.h"
+#include "png.h"
 
 extern enum lb_input_mode {
 	INPUT_SELECT,
@@ -20,6 +22,12 @@ extern enum lb_drag_mode {
 	DRAG_PAN,
 } drag_mode;
 
+extern enum lb_render_mode {
+	RENDER_STAMPS,
+	RENDER_STAMPS_GPU,
+	RENDER_RIBBON,
+} lb_strokes_render_mode;
+
 enum lb_animate_method {
 	ANIMATE_NONE = 0,
 	ANIMATE_DRAW,
@@ -45,8 +53,26 @@ struct bezier_point {
 	vec2 handles[2];
 };
 
+// A single brush imprint, laid out to match the brush shader's instance attributes
+struct lb_stroke_stamp {
+	vec2 translation;
+	float rotation;
+	float scale;
+	float length; // arc length along the stroke
+};
+
+struct lb_stroke_stamps {
+	struct lb_stroke_stamp* stamps;
+	uint32_t len;
+	uint32_t cap;
+	float length;
+	float scale; // scale and jitter the stamps were built with
+	float jitter;
+	bool valid;
+};
+
+// Editable settings of a stroke, its geometry and render caches are kept by the stroke store
 struct lb_stroke {
-	struct bezier_point* vertices;
 	float global_start_time;
 	float full_duration;
 	float scale;
@@ -55,27 +81,57 @@ struct lb_stroke {
 	
 	struct lb_stroke_transition enter;
 	struct lb_stroke_transition exit;
-	
-	uint16_t vertices_len;
 };
 
 enum lb_export_type {
 	EXPORT_SPRITESHEET = 0,
 	EXPORT_IMAGE_SEQUENCE,
+	EXPORT_GIF,
+	EXPORT_RAW_STREAM, // uncompressed frames to a pipe, file or stdout
+};
+
+enum lb_sheet_layout {
+	SHEET_LAYOUT_STRIP = 0, // every frame stacked top to bottom, played with CSS steps()
+	SHEET_LAYOUT_GRID, // unique frames in a grid about as wide as it is tall
+	SHEET_LAYOUT_ATLAS // unique frames trimmed to what they draw and packed in shelves
+};
+
+// Where an export spent its time, for tuning the pipeline
+struct lb_export_stats {
+	uint32_t frames;
+	uint32_t duplicate_frames; // repeats of the frame before them, reused rather than rendered
+	uint32_t threads; // software renderers, or PNG encoders behind the GL renderer
+	uint32_t queue_depth; // frame buffers cycling between the GL renderer and the encoders
+	uint32_t queue_high_water; // most frames waiting for an encoder at once
+	double render_seconds; // drawing and reading back, summed over renderers
+	double stall_seconds; // GL renderer blocked on a full queue
+	double encode_seconds; // summed over threads
+	double write_seconds;
+	double total_seconds;
 };
 
 struct lb_export_options {
 	enum lb_export_type type;
 	
 	bool retina_2x;
+	bool software; // stamp on the CPU instead of through GL
+	uint32_t threads; // software renderers or image sequence encoders, 0 uses every core
+	enum png_compression compression;
+	bool manifest; // also write the holds as JSON, each unique frame with how many frames it lasts
+	struct lb_export_stats* stats; // filled in when set
 	
 	union {
 		struct {
-			bool include_css;
+			bool include_css; // an HTML page for strips, a stylesheet for grids and atlases
+			enum lb_sheet_layout layout;
 		} spritesheet;
 		
 		struct {
 		} image_sequence;
+		
+		struct {
+			bool y4m; // YUV4MPEG2 with alpha instead of headerless RGBA
+		} raw_stream;
 	};
 };
 
@@ -99,8 +155,10 @@ float lb_strokes_setTimelinePosition(float pos);
 void lb_strokes_updateTimeline(float dt);
 
 void lb_strokes_init();
+void lb_strokes_init_headless();
+struct pool_stats lb_strokes_stamps_pool_stats();
 void lb_strokes_render_app();
-void lb_strokes_render_export(const char* outdir, const float fps, struct lb_export_options options);
+bool lb_strokes_render_export(const char* outdir, const float fps, struct lb_export_options options);
 
 void lb_strokes_handleKeyDown(int key, int scancode, int mods);
 void lb_strokes_handleKeyUp(int key, int scancode, int mods);
@@ -111,4 +169,4 @@ void lb_strokes_handleMouseUp(int button);
 void lb_strokes_handleScroll(vec2 dist);
 
 void lb_strokes_save(const char* filename);
-void lb_strokes_open(const char* filename);
\ No newline at end of file
+bool lb_strokes_open(const char* filename);
\ No newline at end of file
@@ -0,0 +1,122 @@
+#include "sweep.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+void sweep_clear(struct interval_sweep* s) {
+	assert(s);
+	s->len = 0;
+	s->active_len = 0;
+	s->started = 0;
+	s->valid = false;
+}
+
+uint32_t sweep_add(struct interval_sweep* s, float begin, float end) {
+	assert(s);
+	if(s->len == s->cap) {
+		s->cap = s->cap ? s->cap * 2 : 64;
+		s->intervals = realloc(s->intervals, sizeof(struct sweep_interval) * s->cap);
+		s->order = realloc(s->order, sizeof(uint32_t) * s->cap);
+		s->active = realloc(s->active, sizeof(uint32_t) * s->cap);
+		assert(s->intervals && s->order && s->active);
+	}
+	s->intervals[s->len] = (struct sweep_interval){begin, end};
+	s->order[s->len] = s->len;
+	s->valid = false;
+	return s->len++;
+}
+
+const struct sweep_interval* sweep_interval(const struct interval_sweep* s, uint32_t id) {
+	assert(s);
+	assert(id < s->len);
+	return &s->intervals[id];
+}
+
+static const struct interval_sweep* sort_sweep;
+static int compare_begin(const void* a, const void* b) {
+	const struct sweep_interval* ia = &sort_sweep->intervals[*(const uint32_t*)a];
+	const struct sweep_interval* ib = &sort_sweep->intervals[*(const uint32_t*)b];
+	if(ia->begin != ib->begin) return ia->begin < ib->begin ? -1 : 1;
+	return *(const uint32_t*)a < *(const uint32_t*)b ? -1 : 1;
+}
+
+// Ids of the intervals containing the time. Moving forward only visits intervals that
+// start or end in between, moving backward restarts the sweep from the beginning.
+// The returned array is owned by the sweep and valid until the next call.
+const uint32_t* sweep_advance(struct interval_sweep* s, float time, uint32_t* len) {
+	assert(s);
+	assert(len);
+	
+	if(!s->valid) {
+		sort_sweep = s;
+		qsort(s->order, s->len, sizeof(uint32_t), compare_begin);
+		s->valid = true;
+		s->active_len = 0;
+		s->started = 0;
+	} else if(time < s->time) {
+		s->active_len = 0;
+		s->started = 0;
+	}
+	s->time = time;
+	
+	// Retire the intervals that have ended
+	uint32_t kept = 0;
+	for(uint32_t i = 0; i < s->active_len; i++) {
+		if(time < s->intervals[s->active[i]].end) s->active[kept++] = s->active[i];
+	}
+	s->active_len = kept;
+	
+	// Admit the ones that have begun, keeping the set in id order
+	for(; s->started < s->len; s->started++) {
+		uint32_t id = s->order[s->started];
+		const struct sweep_interval* interval = &s->intervals[id];
+		if(interval->begin > time) break;
+		if(time >= interval->end) continue;
+		
+		uint32_t lo = 0, hi = s->active_len;
+		while(lo < hi) {
+			uint32_t mid = (lo + hi) / 2;
+			if(s->active[mid] < id) lo = mid + 1;
+			else hi = mid;
+		}
+		memmove(&s->active[lo+1], &s->active[lo], sizeof(uint32_t) * (s->active_len - lo));
+		s->active[lo] = id;
+		s->active_len++;
+	}
+	
+	*len = s->active_len;
+	return s->active;
+}
+
+// Copies of a sweep that has already been advanced once share no state with it,
+// so each can be advanced on its own thread
+void sweep_copy(struct interval_sweep* dst, const struct interval_sweep* src) {
+	assert(dst && src);
+	assert(src->valid || !src->len);
+	if(dst->cap < src->len) {
+		dst->cap = src->len;
+		dst->intervals = realloc(dst->intervals, sizeof(struct sweep_interval) * dst->cap);
+		dst->order = realloc(dst->order, sizeof(uint32_t) * dst->cap);
+		dst->active = realloc(dst->active, sizeof(uint32_t) * dst->cap);
+		assert(dst->intervals && dst->order && dst->active);
+	}
+	dst->len = src->len;
+	if(src->len) {
+		memcpy(dst->intervals, src->intervals, sizeof(struct sweep_interval) * src->len);
+		memcpy(dst->order, src->order, sizeof(uint32_t) * src->len);
+		memcpy(dst->active, src->active, sizeof(uint32_t) * src->active_len);
+	}
+	dst->active_len = src->active_len;
+	dst->started = src->started;
+	dst->time = src->time;
+	dst->valid = src->valid;
+}
+
+void sweep_destroy(struct interval_sweep* s) {
+	assert(s);
+	free(s->intervals);
+	free(s->order);
+	free(s->active);
+	*s = (struct interval_sweep){0};
+}
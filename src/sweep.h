@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Half-open interval [begin, end) of the item with the given id
+struct sweep_interval {
+	float begin;
+	float end;
+};
+
+// Sweep over intervals sorted by their start, advanced incrementally while time moves forward.
+// Ids are the insertion order, the active set is reported in that order.
+struct interval_sweep {
+	struct sweep_interval* intervals; // by id
+	uint32_t* order; // ids sorted by begin
+	uint32_t len, cap;
+	
+	uint32_t* active; // ids active at `time`, ascending
+	uint32_t active_len;
+	uint32_t started; // number of ids in `order` whose begin has been passed
+	float time;
+	bool valid;
+};
+
+void sweep_clear(struct interval_sweep* s);
+uint32_t sweep_add(struct interval_sweep* s, float begin, float end);
+const struct sweep_interval* sweep_interval(const struct interval_sweep* s, uint32_t id);
+const uint32_t* sweep_advance(struct interval_sweep* s, float time, uint32_t* len);
+void sweep_copy(struct interval_sweep* dst, const struct interval_sweep* src);
+void sweep_destroy(struct interval_sweep* s);
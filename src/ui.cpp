@@ -588,9 +588,23 @@ static void drawTools() {
 		if(ImGui::MenuItem("Export...")) show_export_modal = true;
 		ImGui::Separator();
 		
+		if(ImGui::BeginMenu("Renderer")) {
+			if(ImGui::MenuItem("Stamps", NULL, lb_strokes_render_mode == RENDER_STAMPS)) lb_strokes_render_mode = RENDER_STAMPS;
+			if(ImGui::MenuItem("Stamps (GPU curves)", NULL, lb_strokes_render_mode == RENDER_STAMPS_GPU)) lb_strokes_render_mode = RENDER_STAMPS_GPU;
+			if(ImGui::MenuItem("Ribbon", NULL, lb_strokes_render_mode == RENDER_RIBBON)) lb_strokes_render_mode = RENDER_RIBBON;
+			ImGui::EndMenu();
+		}
+		ImGui::Separator();
+		
 		if(ImGui::MenuItem("About Linebaby")) show_about_modal = true;
 		ImGui::Separator();
 		
+		#ifdef DEBUG
+		struct pool_stats stamps_stats = lb_strokes_stamps_pool_stats();
+		ImGui::TextDisabled("Stamp pools: %zu used, %zu peak, %zu slabs (%zu KB)", stamps_stats.used, stamps_stats.highWater, stamps_stats.slabs, stamps_stats.bytesReserved / 1024);
+		ImGui::Separator();
+		#endif
+		
 		if(ImGui::MenuItem("Quit")) close_app();
 		ImGui::EndPopup();
 	}
@@ -651,8 +665,8 @@ static void drawTools() {
 		
 		ImGui::Separator();
 		
-		static const char* export_types[] = { "Sprite Sheet", "Image Sequence" };
-		ImGui::Combo("##Export Type", (int*)&export_options.type, export_types, 2);
+		static const char* export_types[] = { "Sprite Sheet", "Image Sequence", "Animated GIF" };
+		ImGui::Combo("##Export Type", (int*)&export_options.type, export_types, 3);
 		
 		uint32_t frames = ceil(lb_strokes_export_range_duration / (1 / lb_strokes_export_fps));
 		if(lb_strokes_export_range_set) {
@@ -662,18 +676,35 @@ static void drawTools() {
 		switch(export_options.type) {
 			case EXPORT_SPRITESHEET: {
 				if(fps_valid && lb_strokes_export_range_set && lb_strokes_artboard_set) {
-					ImGui::SameLine();
-					ImGui::Text("(%0.0f x %0.0f sheet)", fabsf(lb_strokes_artboard[0].x - lb_strokes_artboard[1].x), frames * fabsf(lb_strokes_artboard[0].y - lb_strokes_artboard[1].y));
+					if(export_options.spritesheet.layout == SHEET_LAYOUT_STRIP) {
+						ImGui::SameLine();
+						ImGui::Text("(%0.0f x %0.0f sheet)", fabsf(lb_strokes_artboard[0].x - lb_strokes_artboard[1].x), frames * fabsf(lb_strokes_artboard[0].y - lb_strokes_artboard[1].y));
+					}
+					static const char* layouts[] = { "Vertical strip", "Grid", "Trimmed atlas" };
+					ImGui::Combo("##Sheet Layout", (int*)&export_options.spritesheet.layout, layouts, 3);
 					ImGui::Checkbox("Include HTML/CSS", &export_options.spritesheet.include_css);
 				}
 				break;
 			}
 			case EXPORT_IMAGE_SEQUENCE:
 				
+				break;
+			case EXPORT_GIF:
+				ImGui::SameLine();
+				ImGui::Text("(over the background colour)");
+				break;
+			case EXPORT_RAW_STREAM: // command line only
 				break;
 		}
 		
 		ImGui::Checkbox("@2x retina", &export_options.retina_2x);
+		ImGui::Checkbox("Software renderer", &export_options.software);
+		ImGui::Checkbox("Include frame manifest", &export_options.manifest);
+		
+		if(export_options.type != EXPORT_GIF) {
+			static const char* compressions[] = { "Balanced compression", "Fast compression", "Smallest files" };
+			ImGui::Combo("##Compression", (int*)&export_options.compression, compressions, 3);
+		}
 		
 		ImGui::Separator();
 		
@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <float.h>
 #include <string.h>
+#include <time.h>
 
 int32_t windowWidth, windowHeight;
 int32_t framebufferWidth, framebufferHeight;
@@ -30,7 +31,9 @@ void update_ortho(mat4 dest, float left, float right, float bottom, float top, f
 }
 
 float vec2_dist(const vec2 a, const vec2 b) {
-	return sqrt(pow(b.x - a.x, 2) + pow(b.y - a.y, 2));
+	double dx = b.x - a.x;
+	double dy = b.y - a.y;
+	return sqrt(dx*dx + dy*dy);
 }
 
 float vec2_len(const vec2 a) {
@@ -67,90 +70,165 @@ uint16_t hyperbola_min_segments(const float length) {
 	return (uint16_t) ceil(sqrt(segments*segments*0.6 + min*min));
 }
 
-static float bezier_distance_cache[BEZIER_DISTANCE_CACHE_SIZE];
-static float bezier_distance_total;
-
-float bezier_distance_update_cache(const vec2 a, const vec2 h1, const vec2 h2, const vec2 b) {
+float bezier_distance_update_cache(struct bezier_distance_cache* cache, const vec2 a, const vec2 h1, const vec2 h2, const vec2 b) {
+	assert(cache);
 	
-	size_t i = 0;
-	bezier_distance_total = 0.0f;
-
-	float t1 = 0.0f;
-	vec2 p1 = bezier_cubic(a, h1, h2, b, t1);
-	float t2;
+	float total = 0.0f;
+	vec2 p1 = a;
 	vec2 p2;
 
-	for(i = 0; i < BEZIER_DISTANCE_CACHE_SIZE; i++) {
-		t2 = ((float)i+1) / ((float)BEZIER_DISTANCE_CACHE_SIZE); // x distances requires x+1 discrete points
-		p2 = bezier_cubic(a, h1, h2, b, t2);
-
-		bezier_distance_cache[i] = vec2_dist(p1, p2);
-		bezier_distance_total += bezier_distance_cache[i];
-
+	for(size_t i = 0; i < BEZIER_DISTANCE_CACHE_SIZE; i++) {
+		float t = ((float)i+1) / ((float)BEZIER_DISTANCE_CACHE_SIZE); // x distances requires x+1 discrete points
+		p2 = bezier_cubic(a, h1, h2, b, t);
+		
+		total += vec2_dist(p1, p2);
+		cache->lengths[i] = total;
+		
 		p1 = p2;
-		t1 = t2;
 	}
+	
+	cache->total = total;
+	cache->valid = true;
+	return total;
+}
 
-	return bezier_distance_total;
+// Linear interpolation of t within table entry [i], which brackets the requested length
+static float bezier_distance_interpolate_t(const struct bezier_distance_cache* cache, size_t i, float dist_length) {
+	float prev_length = i ? cache->lengths[i-1] : 0.0f;
+	float span = cache->lengths[i] - prev_length;
+	float t1 = (float)i / (float)BEZIER_DISTANCE_CACHE_SIZE;
+	float t2 = ((float)i+1) / (float)BEZIER_DISTANCE_CACHE_SIZE;
+	if(span <= 0.0f) return t1;
+	return t1 + (t2-t1)*((dist_length - prev_length) / span);
 }
 
-float bezier_distance_closest_t(float dist_t) {
+float bezier_distance_closest_t(const struct bezier_distance_cache* cache, float dist_t) {
+	assert(cache);
 	if(dist_t <= 0.0f || dist_t >= 1.0f) return dist_t;
 	
-	float dist_length = bezier_distance_total * dist_t;
+	float dist_length = cache->total * dist_t;
 	
-	float dist_accum = 0.0f;
-	size_t i;
-	for(i = 0; i < BEZIER_DISTANCE_CACHE_SIZE; i++) {
-		dist_accum += bezier_distance_cache[i];
-		if(dist_accum >= dist_length) {
-			break;
-		}
+	// Binary search for the first accumulated length reaching the requested distance
+	size_t lo = 0, hi = BEZIER_DISTANCE_CACHE_SIZE-1;
+	while(lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if(cache->lengths[mid] < dist_length) lo = mid + 1;
+		else hi = mid;
 	}
 	
-	// requested distance is within distance [i] (between (t) points [i] and [i+1])
-	// simple linear interpolation between t1 and t2 mapped to distance
-	float t1 = (float)i / (float)BEZIER_DISTANCE_CACHE_SIZE;
-	float t2 = ((float)i+1) / (float)BEZIER_DISTANCE_CACHE_SIZE;
-	float prev_dist = dist_accum - bezier_distance_cache[i];
-	return t1 + (t2-t1)*((dist_length - prev_dist) / (dist_accum - prev_dist));
+	return bezier_distance_interpolate_t(cache, lo, dist_length);
+}
+
+// Writes the t of the equidistant points [first, first+count) of a curve divided into `steps` equal lengths.
+// The points are visited in increasing distance, so the table is walked once for the whole batch.
+void bezier_distance_equidistant_t(const struct bezier_distance_cache* cache, uint32_t steps, uint32_t first, uint32_t count, float* t_out) {
+	assert(cache);
+	assert(steps);
+	assert(t_out);
+	
+	size_t i = 0;
+	for(uint32_t p = 0; p < count; p++) {
+		float dist_t = (first + p) / (float)steps;
+		if(dist_t <= 0.0f || dist_t >= 1.0f) {
+			t_out[p] = dist_t;
+			continue;
+		}
+		
+		float dist_length = cache->total * dist_t;
+		while(i < BEZIER_DISTANCE_CACHE_SIZE-1 && cache->lengths[i] < dist_length) i++;
+		t_out[p] = bezier_distance_interpolate_t(cache, i, dist_length);
+	}
 }
 
-// Finds the closest point on the curve to the supplied point
-vec2 bezier_closest_point(const vec2 a, const vec2 h1, const vec2 h2, const vec2 b, uint16_t resolution, uint16_t iterations, vec2 point) {
+#define BEZIER_CLOSEST_SAMPLES 16
+#define BEZIER_CLOSEST_ITERATIONS 8
+
+// Parameter of the closest point on the curve to the supplied point.
+// The squared distance is sampled coarsely to bracket its minima, then each one is
+// refined with Newton steps on its derivative, (B(t) - point) . B'(t), a quintic.
+float bezier_closest_t(const vec2 a, const vec2 h1, const vec2 h2, const vec2 b, vec2 point) {
+	// Power basis, B(t) = c0 + c1 t + c2 t^2 + c3 t^3, with c0 relative to the point
+	const vec2 c0 = {a.x - point.x, a.y - point.y};
+	const vec2 c1 = {3*(h1.x - a.x), 3*(h1.y - a.y)};
+	const vec2 c2 = {3*(a.x - 2*h1.x + h2.x), 3*(a.y - 2*h1.y + h2.y)};
+	const vec2 c3 = {b.x - a.x + 3*(h1.x - h2.x), b.y - a.y + 3*(h1.y - h2.y)};
+	
+	#define CURVE(t, axis) (((c3.axis*(t) + c2.axis)*(t) + c1.axis)*(t) + c0.axis)
+	#define DIST_SQ(t) (CURVE(t, x)*CURVE(t, x) + CURVE(t, y)*CURVE(t, y))
 	
-	uint16_t closest_idx;
-	vec2 points_on_curve[resolution];
-	float distances[resolution];
-	float start_t = 0;
-	float end_t = 1;
+	float samples[BEZIER_CLOSEST_SAMPLES+1];
+	for(uint16_t i = 0; i <= BEZIER_CLOSEST_SAMPLES; i++) samples[i] = DIST_SQ(i / (float)BEZIER_CLOSEST_SAMPLES);
+	
+	float closest_t = 0.0f;
+	float closest = samples[0];
+	if(samples[BEZIER_CLOSEST_SAMPLES] < closest) {
+		closest_t = 1.0f;
+		closest = samples[BEZIER_CLOSEST_SAMPLES];
+	}
 	
-	for(uint16_t i = 0; i < iterations; i++) {
+	for(uint16_t i = 0; i <= BEZIER_CLOSEST_SAMPLES; i++) {
+		if(i > 0 && samples[i-1] < samples[i]) continue;
+		if(i < BEZIER_CLOSEST_SAMPLES && samples[i+1] < samples[i]) continue;
 		
-		for(uint16_t r = 0; r < resolution; r++) {
-			points_on_curve[r] = bezier_cubic(a, h1, h2, b, map(r, 0, resolution, start_t, end_t));
-			distances[r] = vec2_dist(points_on_curve[r], point);
+		// The minimum lies between the neighbouring samples
+		float lo = (i > 0 ? i-1 : 0) / (float)BEZIER_CLOSEST_SAMPLES;
+		float hi = (i < BEZIER_CLOSEST_SAMPLES ? i+1 : i) / (float)BEZIER_CLOSEST_SAMPLES;
+		float t = i / (float)BEZIER_CLOSEST_SAMPLES;
+		for(uint16_t n = 0; n < BEZIER_CLOSEST_ITERATIONS; n++) {
+			vec2 d = {CURVE(t, x), CURVE(t, y)};
+			vec2 d1 = {(3*c3.x*t + 2*c2.x)*t + c1.x, (3*c3.y*t + 2*c2.y)*t + c1.y};
+			vec2 d2 = {6*c3.x*t + 2*c2.x, 6*c3.y*t + 2*c2.y};
+			float f = d.x*d1.x + d.y*d1.y;
+			float df = d1.x*d1.x + d1.y*d1.y + d.x*d2.x + d.y*d2.y;
+			if(df <= 0.0f) break; // not convex here, keep the sample
+			
+			float next = t - f / df;
+			if(next < lo) next = lo;
+			else if(next > hi) next = hi;
+			float step = fabsf(next - t);
+			t = next;
+			if(step < 1e-6f) break;
 		}
 		
-		float smallest = FLT_MAX;
-		for(uint16_t r = 0; r < resolution; r++) {
-			if(smallest > distances[r]) {
-				smallest = distances[r];
-				closest_idx = r;
-			}
+		float dist = DIST_SQ(t);
+		if(dist < closest) {
+			closest = dist;
+			closest_t = t;
 		}
-		
-		float midpoint_t = map(closest_idx, 0, resolution, start_t, end_t);
-		float spread = end_t - start_t;
-		start_t = midpoint_t - spread/3.0f;
-		if(start_t < 0) start_t = 0;
-		end_t = midpoint_t + spread/3.0f;
-		if(end_t > 1) end_t = 1;
 	}
 	
-	return points_on_curve[closest_idx];
+	#undef DIST_SQ
+	#undef CURVE
+	return closest_t;
+}
+
+vec2 bezier_closest_point(const vec2 a, const vec2 h1, const vec2 h2, const vec2 b, vec2 point) {
+	return bezier_cubic(a, h1, h2, b, bezier_closest_t(a, h1, h2, b, point));
+}
+
+// Distance from the point to the curve when it is at most max_dist away.
+// The control polygon's box bounds the curve, so far away segments are rejected without solving.
+bool bezier_distance_within(const vec2 a, const vec2 h1, const vec2 h2, const vec2 b, vec2 point, float max_dist, float* dist) {
+	float min_x = fminf(fminf(a.x, h1.x), fminf(h2.x, b.x));
+	float max_x = fmaxf(fmaxf(a.x, h1.x), fmaxf(h2.x, b.x));
+	float min_y = fminf(fminf(a.y, h1.y), fminf(h2.y, b.y));
+	float max_y = fmaxf(fmaxf(a.y, h1.y), fmaxf(h2.y, b.y));
+	float dx = fmaxf(fmaxf(min_x - point.x, point.x - max_x), 0.0f);
+	float dy = fmaxf(fmaxf(min_y - point.y, point.y - max_y), 0.0f);
+	if(dx*dx + dy*dy > max_dist*max_dist) return false;
+	
+	float d = vec2_dist(point, bezier_closest_point(a, h1, h2, b, point));
+	if(d > max_dist) return false;
+	if(dist) *dist = d;
+	return true;
 }
 
 float map(float value, float istart, float istop, float ostart, float ostop) {
 	return ostart + (ostop - ostart) * ((value - istart) / (istop - istart));
 }
+
+double monotonic_seconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 
 // -- Globals --
 extern int32_t windowWidth, windowHeight;
@@ -26,6 +27,7 @@ vec2 vec2_add(const vec2 a, const vec2 b);
 vec2 vec2_sub(const vec2 a, const vec2 b);
 
 float map(float value, float istart, float istop, float ostart, float ostop);
+double monotonic_seconds();
 
 typedef union color32 {
 	struct {
@@ -49,7 +51,15 @@ float bezier_estimate_length(const vec2 a, const vec2 h1, const vec2 h2, const v
 uint16_t hyperbola_min_segments(const float length);
 
 #define BEZIER_DISTANCE_CACHE_SIZE 512
-float bezier_distance_update_cache(const vec2 a, const vec2 h1, const vec2 h2, const vec2 b);
-float bezier_distance_closest_t(float dist_t);
-vec2 bezier_closest_point(const vec2 a, const vec2 h1, const vec2 h2, const vec2 b, uint16_t resolution, uint16_t iterations, vec2 point);
+struct bezier_distance_cache {
+	float lengths[BEZIER_DISTANCE_CACHE_SIZE]; // arc length accumulated up to t = (i+1)/BEZIER_DISTANCE_CACHE_SIZE
+	float total;
+	bool valid;
+};
+float bezier_distance_update_cache(struct bezier_distance_cache* cache, const vec2 a, const vec2 h1, const vec2 h2, const vec2 b);
+float bezier_distance_closest_t(const struct bezier_distance_cache* cache, float dist_t);
+void bezier_distance_equidistant_t(const struct bezier_distance_cache* cache, uint32_t steps, uint32_t first, uint32_t count, float* t_out);
+float bezier_closest_t(const vec2 a, const vec2 h1, const vec2 h2, const vec2 b, vec2 point);
+vec2 bezier_closest_point(const vec2 a, const vec2 h1, const vec2 h2, const vec2 b, vec2 point);
+bool bezier_distance_within(const vec2 a, const vec2 h1, const vec2 h2, const vec2 b, vec2 point, float max_dist, float* dist);
 